@@ -0,0 +1,448 @@
+/*----------------------------------------------------------------------------*/
+/*bcache.c*/
+/*----------------------------------------------------------------------------*/
+/*The implementation of the shared cache of blocks of small files*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*----------------------------------------------------------------------------*/
+#include <sys/mman.h>
+/*----------------------------------------------------------------------------*/
+#include "bcache.h"
+#include "lib.h"
+#include "debug.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*Hashes the key of a block*/
+#define BCACHE_HASH(fsid, ino, block)\
+	((unsigned long)(((fsid) * 31 + (ino)) * 31 + (block)))
+/*----------------------------------------------------------------------------*/
+/*Selects the part of the cache responsible for the given hash*/
+#define BCACHE_SHARD(hash) (&bcache_shards[(hash) % BCACHE_SHARDS])
+/*----------------------------------------------------------------------------*/
+/*Selects the bucket in a part of the cache responsible for the given hash*/
+#define BCACHE_BUCKET(shard, hash)\
+	(&(shard)->buckets[((hash) / BCACHE_SHARDS) % BCACHE_BUCKETS])
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The parts of the cache*/
+static bcache_shard_t bcache_shards[BCACHE_SHARDS];
+/*----------------------------------------------------------------------------*/
+/*The capacity of the cache in bytes (may be overwritten by the user)*/
+size_t bcache_size = BCACHE_SIZE;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Initializes the cache of blocks*/
+void
+bcache_init
+	(
+	size_t bytes_max
+	)
+	{
+	int i;
+	
+	/*Each part of the cache gets an equal share of the capacity*/
+	for(i = 0; i < BCACHE_SHARDS; ++i)
+		{
+		memset(&bcache_shards[i], 0, sizeof(bcache_shard_t));
+		bcache_shards[i].bytes_max = bytes_max / BCACHE_SHARDS;
+		mutex_init(&bcache_shards[i].lock);
+		}
+	}/*bcache_init*/
+/*----------------------------------------------------------------------------*/
+/*Takes `block` out of `shard` (which must be locked) and frees it*/
+static
+void
+bcache_block_remove
+	(
+	bcache_shard_t * shard,
+	bcache_block_t * block
+	)
+	{
+	/*The link pointing to the block in its bucket*/
+	bcache_block_t ** link = BCACHE_BUCKET
+		(shard, BCACHE_HASH(block->fsid, block->ino, block->block));
+		
+	/*Take the block out of its bucket*/
+	for(; *link != block; link = &(*link)->hash_next);
+	*link = block->hash_next;
+	
+	/*Take the block out of the LRU chain*/
+	if(block->next)
+		block->next->prev = block->prev;
+	if(block->prev)
+		block->prev->next = block->next;
+	if(shard->mru == block)
+		shard->mru = block->next;
+	if(shard->lru == block)
+		shard->lru = block->prev;
+		
+	/*The memory of the block is not charged any more*/
+	shard->bytes_current -= block->len;
+	
+	/*Free the block; the data were sent by the underlying filesystem*/
+	if(block->len)
+		munmap(block->data, block->len);
+	free(block);
+	}/*bcache_block_remove*/
+/*----------------------------------------------------------------------------*/
+/*Drops the least recently used blocks of `shard` (which must be locked)
+	while it holds too much data*/
+static
+void
+bcache_shard_shrink
+	(
+	bcache_shard_t * shard
+	)
+	{
+	while(shard->lru && (shard->bytes_current > shard->bytes_max))
+		bcache_block_remove(shard, shard->lru);
+	}/*bcache_shard_shrink*/
+/*----------------------------------------------------------------------------*/
+/*Changes the capacity of the cache, dropping the extra blocks*/
+void
+bcache_resize
+	(
+	size_t bytes_max
+	)
+	{
+	int i;
+	
+	/*Apply the new share of the capacity to each part of the cache*/
+	for(i = 0; i < BCACHE_SHARDS; ++i)
+		{
+		mutex_lock(&bcache_shards[i].lock);
+		bcache_shards[i].bytes_max = bytes_max / BCACHE_SHARDS;
+		bcache_shard_shrink(&bcache_shards[i]);
+		mutex_unlock(&bcache_shards[i].lock);
+		}
+	}/*bcache_resize*/
+/*----------------------------------------------------------------------------*/
+/*Copies at most `*len` bytes starting at `start` in the block `block` of the
+	file described by `stat` into `data`; returns zero if the block is not in
+	the cache or is out of date*/
+static
+int
+bcache_block_copy
+	(
+	io_statbuf_t * stat,
+	unsigned long block,
+	size_t start,
+	void * data,
+	size_t * len
+	)
+	{
+	int found = 0;
+
+	/*The key of the block*/
+	unsigned long long fsid = stat->st_fsid;
+	ino_t ino = stat->st_ino;
+	unsigned long hash = BCACHE_HASH(fsid, ino, block);
+	
+	/*The part of the cache holding the block*/
+	bcache_shard_t * shard = BCACHE_SHARD(hash);
+	
+	/*The block being looked at*/
+	bcache_block_t * b;
+	
+	mutex_lock(&shard->lock);
+	
+	/*Look for the block in its bucket*/
+	for(b = *BCACHE_BUCKET(shard, hash); b; b = b->hash_next)
+		if((b->fsid == fsid) && (b->ino == ino) && (b->block == block))
+			break;
+	
+	if(b)
+		{
+		/*if the file has changed since the block was read, drop the block*/
+		if
+			(
+			!TIMESPEC_EQUAL(b->mtime, stat->st_mtim)
+			|| (b->size != stat->st_size) || (b->len < start + *len)
+			)
+			bcache_block_remove(shard, b);
+		else
+			{
+			/*copy the data*/
+			memcpy(data, b->data + start, *len);
+			found = 1;
+			
+			/*move the block to the MRU end*/
+			if(shard->mru != b)
+				{
+				b->prev->next = b->next;
+				if(b->next)
+					b->next->prev = b->prev;
+				else
+					shard->lru = b->prev;
+				b->prev = NULL;
+				b->next = shard->mru;
+				shard->mru->prev = b;
+				shard->mru = b;
+				}
+			}
+		}
+	
+	mutex_unlock(&shard->lock);
+	
+	return found;
+	}/*bcache_block_copy*/
+/*----------------------------------------------------------------------------*/
+/*Puts the block `block` of the file described by `stat` into the cache; the
+	cache takes over `data`, which must have been sent by the underlying
+	filesystem*/
+static
+void
+bcache_block_insert
+	(
+	io_statbuf_t * stat,
+	unsigned long block,
+	char * data,
+	size_t len
+	)
+	{
+	/*The key of the block*/
+	unsigned long long fsid = stat->st_fsid;
+	ino_t ino = stat->st_ino;
+	unsigned long hash = BCACHE_HASH(fsid, ino, block);
+	
+	/*The part of the cache to hold the block*/
+	bcache_shard_t * shard = BCACHE_SHARD(hash);
+	
+	/*The bucket of the block and the block being looked at*/
+	bcache_block_t ** bucket, * b;
+	
+	/*Create the block*/
+	bcache_block_t * block_new = malloc(sizeof(bcache_block_t));
+	if(!block_new)
+		{
+		if(len)
+			munmap(data, len);
+		return;
+		}
+	block_new->fsid = fsid;
+	block_new->ino = ino;
+	block_new->block = block;
+	block_new->mtime = stat->st_mtim;
+	block_new->size = stat->st_size;
+	block_new->data = data;
+	block_new->len = len;
+	
+	mutex_lock(&shard->lock);
+	
+	/*If another thread has put the same block in meanwhile, replace it*/
+	bucket = BCACHE_BUCKET(shard, hash);
+	for(b = *bucket; b; b = b->hash_next)
+		if((b->fsid == fsid) && (b->ino == ino) && (b->block == block))
+			{
+			bcache_block_remove(shard, b);
+			break;
+			}
+	
+	/*Add the block to its bucket and to the MRU end of the chain*/
+	block_new->hash_next = *bucket;
+	*bucket = block_new;
+	block_new->prev = NULL;
+	block_new->next = shard->mru;
+	if(shard->mru)
+		shard->mru->prev = block_new;
+	else
+		shard->lru = block_new;
+	shard->mru = block_new;
+	shard->bytes_current += len;
+	
+	/*Respect the capacity*/
+	bcache_shard_shrink(shard);
+	
+	mutex_unlock(&shard->lock);
+	}/*bcache_block_insert*/
+/*----------------------------------------------------------------------------*/
+/*Obtains the attributes of `node` (which must be locked), from the cache of
+	attributes if possible*/
+static
+error_t
+bcache_stat_get
+	(
+	node_t * node,
+	io_statbuf_t * stat
+	)
+	{
+	error_t err;
+	
+	/*If the cached attributes are still valid, use them*/
+	if(lnode_stat_fetch(node->nn->lnode, stat) == 0)
+		return 0;
+		
+	/*Ask the underlying file and remember the answer*/
+	err = node_port_ensure(node, O_READ);
+	if(!err)
+		err = io_stat(node->nn->port, stat);
+	if(!err)
+		lnode_stat_store(node->nn->lnode, stat);
+		
+	return err;
+	}/*bcache_stat_get*/
+/*----------------------------------------------------------------------------*/
+/*Tries to serve a read of `len` bytes at `offset` from `node` (which must be
+	locked) from the cache, reading the missing blocks of the file into it;
+	returns ENODATA if the file is not cached*/
+error_t
+bcache_read
+	(
+	node_t * node,
+	loff_t offset,
+	size_t * len,
+	void * data
+	)
+	{
+	error_t err;
+	
+	/*The attributes of the file*/
+	io_statbuf_t stat;
+	
+	/*The number of bytes copied so far and the size of the current piece*/
+	size_t done, n;
+	
+	/*The position being read and the block containing it*/
+	loff_t pos;
+	unsigned long block;
+	
+	/*The data of a block read from the underlying file*/
+	char * buf;
+	mach_msg_type_number_t buf_len;
+	
+	/*If the cache is disabled, stop*/
+	if(bcache_size == 0)
+		return ENODATA;
+		
+	/*Only small regular files are cached*/
+	err = bcache_stat_get(node, &stat);
+	if(err || !S_ISREG(stat.st_mode) || (stat.st_size > BCACHE_FILE_MAX))
+		return ENODATA;
+		
+	/*Do not read past the end of the file*/
+	if(offset >= stat.st_size)
+		{
+		*len = 0;
+		return 0;
+		}
+	if(offset + *len > stat.st_size)
+		*len = stat.st_size - offset;
+		
+	/*Go through the blocks covering the requested range*/
+	for(done = 0; done < *len; done += n)
+		{
+		pos = offset + done;
+		block = pos / BCACHE_BLOCK_SIZE;
+		
+		/*the size of the piece of the range in the current block*/
+		n = BCACHE_BLOCK_SIZE - pos % BCACHE_BLOCK_SIZE;
+		if(n > *len - done)
+			n = *len - done;
+		
+		/*if the block is in the cache, it has been copied: go on*/
+		if(bcache_block_copy
+			(&stat, block, pos % BCACHE_BLOCK_SIZE, (char *)data + done, &n))
+			continue;
+			
+		/*read the whole block; let the stub allocate the memory, so that the
+			cache could keep it*/
+		err = node_port_ensure(node, O_READ);
+		if(err)
+			return ENODATA;
+		buf = NULL;
+		buf_len = 0;
+		err = io_read
+			(node->nn->port, &buf, &buf_len,
+			(loff_t)block * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+		if(err)
+			return ENODATA;
+			
+		/*if the block is shorter than it should be, the file has changed under
+			our feet: let the ordinary read handle it*/
+		if(buf_len < pos % BCACHE_BLOCK_SIZE + n)
+			{
+			if(buf_len)
+				munmap(buf, buf_len);
+			return ENODATA;
+			}
+		
+		/*copy the data and keep the block*/
+		memcpy((char *)data + done, buf + pos % BCACHE_BLOCK_SIZE, n);
+		bcache_block_insert(&stat, block, buf, buf_len);
+		}
+		
+	/*The whole range has been served*/
+	return 0;
+	}/*bcache_read*/
+/*----------------------------------------------------------------------------*/
+/*Drops the cached blocks of the file described by `stat` (e.g. because the
+	file has been written to)*/
+void
+bcache_file_drop
+	(
+	io_statbuf_t * stat
+	)
+	{
+	/*The key of the blocks*/
+	unsigned long long fsid = stat->st_fsid;
+	ino_t ino = stat->st_ino;
+	unsigned long block, hash;
+	
+	/*The part of the cache holding the current block*/
+	bcache_shard_t * shard;
+	
+	/*The block being looked at*/
+	bcache_block_t * b;
+	
+	/*If the cache is disabled, there is nothing to drop*/
+	if(bcache_size == 0)
+		return;
+	
+	/*Go through all the blocks a cached file might have*/
+	for(block = 0; block * BCACHE_BLOCK_SIZE < BCACHE_FILE_MAX; ++block)
+		{
+		hash = BCACHE_HASH(fsid, ino, block);
+		shard = BCACHE_SHARD(hash);
+		
+		mutex_lock(&shard->lock);
+		
+		/*drop the block, if it is in the cache*/
+		for(b = *BCACHE_BUCKET(shard, hash); b; b = b->hash_next)
+			if((b->fsid == fsid) && (b->ino == ino) && (b->block == block))
+				{
+				bcache_block_remove(shard, b);
+				break;
+				}
+				
+		mutex_unlock(&shard->lock);
+		}
+	}/*bcache_file_drop*/
+/*----------------------------------------------------------------------------*/
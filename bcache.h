@@ -0,0 +1,143 @@
+/*----------------------------------------------------------------------------*/
+/*bcache.h*/
+/*----------------------------------------------------------------------------*/
+/*The shared cache of blocks of small files*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+#ifndef __BCACHE_H__
+#define __BCACHE_H__
+
+/*----------------------------------------------------------------------------*/
+#include <error.h>
+#include <hurd/netfs.h>
+/*----------------------------------------------------------------------------*/
+#include "node.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*The default capacity of the cache in bytes (0 disables the cache)*/
+#define BCACHE_SIZE 0
+/*----------------------------------------------------------------------------*/
+/*The size of a block*/
+#define BCACHE_BLOCK_SIZE 4096
+/*----------------------------------------------------------------------------*/
+/*The maximal size of a file whose blocks are cached*/
+#define BCACHE_FILE_MAX (64*1024)
+/*----------------------------------------------------------------------------*/
+/*The number of independently locked parts of the cache*/
+#define BCACHE_SHARDS 16
+/*----------------------------------------------------------------------------*/
+/*The number of hash buckets in each part of the cache*/
+#define BCACHE_BUCKETS 64
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Types---------------------------------------------------------------*/
+/*A cached block of a file*/
+struct bcache_block
+	{
+	/*the file and the number of the block in it*/
+	unsigned long long fsid;
+	ino_t ino;
+	unsigned long block;
+	
+	/*the modification time and the size of the file when the block was read;
+		the block is only valid while the file still has them*/
+	struct timespec mtime;
+	loff_t size;
+	
+	/*the data and their length (shorter than a block at the end of a file)*/
+	char * data;
+	size_t len;
+	
+	/*the next block in the same hash bucket*/
+	struct bcache_block * hash_next;
+	
+	/*the neighbours in the LRU chain*/
+	struct bcache_block * prev, * next;
+	};/*struct bcache_block*/
+/*----------------------------------------------------------------------------*/
+typedef struct bcache_block bcache_block_t;
+/*----------------------------------------------------------------------------*/
+/*An independently locked part of the cache*/
+struct bcache_shard
+	{
+	/*the hash table of the blocks*/
+	bcache_block_t * buckets[BCACHE_BUCKETS];
+	
+	/*the ends of the LRU chain*/
+	bcache_block_t * mru, * lru;
+	
+	/*the maximal and the current number of bytes of data*/
+	size_t bytes_max, bytes_current;
+	
+	/*a lock*/
+	struct mutex lock;
+	};/*struct bcache_shard*/
+/*----------------------------------------------------------------------------*/
+typedef struct bcache_shard bcache_shard_t;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The capacity of the cache in bytes (may be overwritten by the user)*/
+extern size_t bcache_size;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Initializes the cache of blocks*/
+void
+bcache_init
+	(
+	size_t bytes_max
+	);
+/*----------------------------------------------------------------------------*/
+/*Changes the capacity of the cache, dropping the extra blocks*/
+void
+bcache_resize
+	(
+	size_t bytes_max
+	);
+/*----------------------------------------------------------------------------*/
+/*Tries to serve a read of `len` bytes at `offset` from `node` (which must be
+	locked) from the cache, reading the missing blocks of the file into it;
+	returns ENODATA if the file is not cached*/
+error_t
+bcache_read
+	(
+	node_t * node,
+	loff_t offset,
+	size_t * len,
+	void * data
+	);
+/*----------------------------------------------------------------------------*/
+/*Drops the cached blocks of the file described by `stat` (e.g. because the
+	file has been written to)*/
+void
+bcache_file_drop
+	(
+	io_statbuf_t * stat
+	);
+/*----------------------------------------------------------------------------*/
+#endif /*__BCACHE_H__*/
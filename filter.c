@@ -0,0 +1,1010 @@
+/*----------------------------------------------------------------------------*/
+/*filter.c*/
+/*----------------------------------------------------------------------------*/
+/*The implementation of checking the property of files*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*----------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <maptime.h>
+/*----------------------------------------------------------------------------*/
+#include "filter.h"
+#include "filterfs.h"
+#include "options.h"
+#include "debug.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The epoch of the property*/
+unsigned long property_epoch;
+/*----------------------------------------------------------------------------*/
+/*Whether the verdicts on directories are inherited by their subtrees (may
+	be overwritten by the user)*/
+int filter_prune = FILTER_PRUNE;
+/*----------------------------------------------------------------------------*/
+/*The property (NULL if every file is accepted); it is only used and
+	swapped under the lock of the executor*/
+static filter_property_t * filter_property;
+/*----------------------------------------------------------------------------*/
+/*The table of rules and the number of rules; they are only used and swapped
+	under the lock of the executor, like the property*/
+static filter_rule_t * filter_rules;
+static int filter_rules_count;
+/*----------------------------------------------------------------------------*/
+/*The bounds of the number of filtering commands running at once and the
+	target latency of a command (may be overwritten by the user)*/
+int filter_concurrency = FILTER_CONCURRENCY;
+int filter_concurrency_min = FILTER_CONCURRENCY_MIN;
+int filter_target_latency = FILTER_TARGET_LATENCY;
+/*----------------------------------------------------------------------------*/
+/*The number of filtering commands which may run at once now, chosen between
+	the bounds from the observed latency*/
+static int filter_limit = FILTER_CONCURRENCY_INITIAL;
+/*----------------------------------------------------------------------------*/
+/*The number of commands completed in time since the limit changed last, the
+	time of the last decrease, the smoothed latency of the commands, the
+	lowest value it has had, and the number of commands since that value
+	was recorded (all times are in microseconds)*/
+static int filter_in_time;
+static long long filter_decreased;
+static long long filter_latency, filter_baseline;
+static int filter_samples;
+/*----------------------------------------------------------------------------*/
+/*The way of choosing the class of the next job (may be overwritten by the
+	user)*/
+int filter_priority = FILTER_PRIORITY;
+/*----------------------------------------------------------------------------*/
+/*The maximal number of filtering commands running at once on behalf of one
+	user (may be overwritten by the user)*/
+int filter_user_concurrency = FILTER_USER_CONCURRENCY;
+/*----------------------------------------------------------------------------*/
+/*The clients of each class, in a ring; each of them points to the client
+	whose turn it is*/
+static filter_client_t * filter_turn[FILTER_CLASSES];
+/*----------------------------------------------------------------------------*/
+/*The weights of the classes and the numbers of jobs each class may still
+	start in the current round of the weighted scheduling*/
+static const int filter_weights[FILTER_CLASSES] =
+	{FILTER_WEIGHT_LOOKUP, FILTER_WEIGHT_LISTING, FILTER_WEIGHT_BACKGROUND};
+static int filter_credits[FILTER_CLASSES];
+/*----------------------------------------------------------------------------*/
+/*The number of jobs whose commands are running (or being started)*/
+static int filter_running_count;
+/*----------------------------------------------------------------------------*/
+/*The lock protecting the executor*/
+static struct mutex filter_lock = MUTEX_INITIALIZER;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Returns the current time in microseconds*/
+static
+long long
+filter_now(void)
+	{
+	struct timeval tv;
+	maptime_read(maptime, &tv);
+	return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+	}/*filter_now*/
+/*----------------------------------------------------------------------------*/
+/*Keeps the limit of running commands within the bounds (the executor must
+	be locked)*/
+static
+void
+filter_limit_clamp(void)
+	{
+	if(filter_limit > filter_concurrency)
+		filter_limit = filter_concurrency;
+	if(filter_limit < filter_concurrency_min)
+		filter_limit = filter_concurrency_min;
+	if(filter_limit < 1)
+		filter_limit = 1;
+	}/*filter_limit_clamp*/
+/*----------------------------------------------------------------------------*/
+/*Adjusts the number of commands which may run at once after `job` has
+	completed: the limit grows by one for every `filter_limit` commands
+	completed in time while all slots were taken, and shrinks by a quarter
+	when the commands get slower than the target, which happens when the
+	filters overload the disk or the processor (the executor must be
+	locked)*/
+static
+void
+filter_adapt
+	(
+	filter_job_t * job
+	)
+	{
+	/*The time and the latency of the command*/
+	long long now = filter_now();
+	long long latency = now - job->start;
+	
+	/*The latency above which fewer commands must run*/
+	long long target;
+	
+	/*Smooth the latency, so that a single slow or fast file changes little*/
+	filter_latency = (filter_latency)
+		? ((filter_latency * 7 + latency) / 8) : (latency);
+		
+	/*Remember the lowest latency, the one of an unloaded filter; forget it
+		from time to time, since the filter may change*/
+	if
+		(
+		!filter_baseline || (filter_latency < filter_baseline)
+		|| (++filter_samples >= FILTER_BASELINE_SAMPLES)
+		)
+		{
+		filter_baseline = filter_latency;
+		filter_samples = 0;
+		}
+	
+	/*If the bounds leave no choice, there is nothing to adapt*/
+	if(filter_concurrency_min >= filter_concurrency)
+		{
+		filter_limit_clamp();
+		return;
+		}
+		
+	/*Find out the target latency*/
+	target = (filter_target_latency > 0)
+		? ((long long)filter_target_latency * 1000)
+		: (filter_baseline * FILTER_LATENCY_TOLERANCE);
+		
+	if(filter_latency > target)
+		{
+		/*decrease once for each overload: the commands started before the
+			last decrease are slow because of the old limit*/
+		if(job->start >= filter_decreased)
+			{
+			filter_limit -= (filter_limit / FILTER_DECREASE)
+				? (filter_limit / FILTER_DECREASE) : (1);
+			filter_decreased = now;
+			filter_in_time = 0;
+			}
+		}
+	/*only the commands which ran with all slots taken show that the limit
+		holds the work back*/
+	else if(job->saturated && (++filter_in_time >= filter_limit))
+		{
+		++filter_limit;
+		filter_in_time = 0;
+		}
+		
+	filter_limit_clamp();
+	}/*filter_adapt*/
+/*----------------------------------------------------------------------------*/
+/*Frees the property `prop`*/
+static
+void
+filter_property_free
+	(
+	filter_property_t * prop
+	)
+	{
+	if(!prop)
+		return;
+		
+	free(prop->text);
+	free(prop->pieces);
+	free(prop);
+	}/*filter_property_free*/
+/*----------------------------------------------------------------------------*/
+/*Splits `text` at the occurrences of PROPERTY_PARAM into the new property
+	`prop`*/
+static
+error_t
+filter_property_compile
+	(
+	const char * text,
+	filter_property_t ** prop
+	)
+	{
+	/*The new property*/
+	filter_property_t * prop_new;
+	
+	/*The length of the property param*/
+	size_t property_param_len = strlen(PROPERTY_PARAM);
+	
+	/*The current piece and the occurrence of PROPERTY_PARAM ending it*/
+	const char * p, * occurrence;
+	int i;
+	
+	prop_new = calloc(1, sizeof(filter_property_t));
+	if(!prop_new)
+		return ENOMEM;
+	prop_new->text = strdup(text);
+	if(!prop_new->text)
+		{
+		filter_property_free(prop_new);
+		return ENOMEM;
+		}
+		
+	/*Count the pieces*/
+	for
+		(
+		prop_new->pieces_count = 1,
+			occurrence = strstr(prop_new->text, PROPERTY_PARAM);
+		occurrence;
+		++prop_new->pieces_count,
+			occurrence = strstr(occurrence + property_param_len, PROPERTY_PARAM)
+		);
+	prop_new->pieces = malloc(prop_new->pieces_count * sizeof(filter_piece_t));
+	if(!prop_new->pieces)
+		{
+		filter_property_free(prop_new);
+		return ENOMEM;
+		}
+		
+	/*Record where each piece lies*/
+	for(i = 0, p = prop_new->text; i < prop_new->pieces_count; ++i)
+		{
+		occurrence = strstr(p, PROPERTY_PARAM);
+		prop_new->pieces[i].start = p;
+		prop_new->pieces[i].len = (occurrence) ? (occurrence - p) : (strlen(p));
+		prop_new->pieces_len += prop_new->pieces[i].len;
+		if(occurrence)
+			p = occurrence + property_param_len;
+		}
+		
+	*prop = prop_new;
+	return 0;
+	}/*filter_property_compile*/
+/*----------------------------------------------------------------------------*/
+/*Builds the filtering command for the file `name` in the directory
+	`dir_path` from the property `prop`; returns NULL if there is not enough
+	memory*/
+static
+char *
+filter_cmd_build
+	(
+	filter_property_t * prop,
+	const char * dir_path,
+	const char * name
+	)
+	{
+	/*The lengths of the parts of the full name of the file*/
+	size_t dir_path_len = strlen(dir_path), name_len = strlen(name);
+	
+	/*The filtering command and the position in it*/
+	char * cmd, * p;
+	int i;
+	
+	/*Allocate the space for the final filtering command*/
+	cmd = malloc(prop->pieces_len
+		+ (dir_path_len + 1 + name_len) * (prop->pieces_count - 1) + 1);
+	if(!cmd)
+		return NULL;
+		
+	/*Put the full name of the file between the pieces*/
+	for(i = 0, p = cmd; i < prop->pieces_count; ++i)
+		{
+		memcpy(p, prop->pieces[i].start, prop->pieces[i].len);
+		p += prop->pieces[i].len;
+		
+		if(i + 1 < prop->pieces_count)
+			{
+			memcpy(p, dir_path, dir_path_len);
+			p += dir_path_len;
+			*p++ = '/';
+			memcpy(p, name, name_len);
+			p += name_len;
+			}
+		}
+	*p = 0;
+	
+	/*LOG_MSG("filter_cmd_build: The filtering command: '%s'.", cmd);*/
+	
+	return cmd;
+	}/*filter_cmd_build*/
+/*----------------------------------------------------------------------------*/
+/*Returns the number of running jobs of the user `uid` in all classes (the
+	executor must be locked)*/
+static
+int
+filter_uid_running
+	(
+	uid_t uid
+	)
+	{
+	/*The number of jobs*/
+	int running = 0;
+	
+	/*The current class and client*/
+	int klass;
+	filter_client_t * client;
+	
+	/*Go through the rings of all classes*/
+	for(klass = 0; klass < FILTER_CLASSES; ++klass)
+		if(filter_turn[klass])
+			{
+			client = filter_turn[klass];
+			do
+				{
+				if(client->uid == uid)
+					running += client->running;
+				client = client->next;
+				}
+			while(client != filter_turn[klass]);
+			}
+			
+	return running;
+	}/*filter_uid_running*/
+/*----------------------------------------------------------------------------*/
+/*Finds or creates the client of the user `uid` in the class `klass`;
+	returns NULL if there is not enough memory (the executor must be
+	locked)*/
+static
+filter_client_t *
+filter_client_get
+	(
+	uid_t uid,
+	int klass
+	)
+	{
+	/*The current client*/
+	filter_client_t * client = filter_turn[klass];
+	
+	/*Try to find the client in the ring*/
+	if(client)
+		do
+			{
+			if(client->uid == uid)
+				return client;
+			client = client->next;
+			}
+		while(client != filter_turn[klass]);
+	
+	/*Create a new client*/
+	client = calloc(1, sizeof(filter_client_t));
+	if(!client)
+		return NULL;
+	client->uid = uid;
+	client->klass = klass;
+	
+	/*Join the ring right after the client whose turn it is*/
+	if(filter_turn[klass])
+		{
+		client->next = filter_turn[klass]->next;
+		filter_turn[klass]->next = client;
+		}
+	else
+		filter_turn[klass] = client->next = client;
+		
+	return client;
+	}/*filter_client_get*/
+/*----------------------------------------------------------------------------*/
+/*Destroys `client` if it has neither queued nor running jobs (the executor
+	must be locked)*/
+static
+void
+filter_client_put
+	(
+	filter_client_t * client
+	)
+	{
+	/*The client preceding `client` in the ring*/
+	filter_client_t * prev;
+	
+	/*If the client still has work, keep it*/
+	if(client->first || client->running)
+		return;
+		
+	/*Leave the ring*/
+	for(prev = client; prev->next != client; prev = prev->next);
+	if(prev == client)
+		filter_turn[client->klass] = NULL;
+	else
+		{
+		prev->next = client->next;
+		if(filter_turn[client->klass] == client)
+			filter_turn[client->klass] = client->next;
+		}
+		
+	free(client);
+	}/*filter_client_put*/
+/*----------------------------------------------------------------------------*/
+/*Chooses the client of class `klass` which starts the next job, by deficit
+	round robin: each client in turn may start FILTER_QUANTUM jobs, unless
+	its user has reached filter_user_concurrency. Returns NULL if no client
+	of the class may start a job (the executor must be locked).*/
+static
+filter_client_t *
+filter_client_pick
+	(
+	int klass
+	)
+	{
+	/*The current client*/
+	filter_client_t * client = filter_turn[klass];
+	
+	if(!client)
+		return NULL;
+	
+	/*Go round the ring once, starting with the client whose turn it is*/
+	do
+		{
+		if
+			(
+			client->first
+			&& ((filter_user_concurrency <= 0)
+				|| (filter_uid_running(client->uid) < filter_user_concurrency))
+			)
+			{
+			/*a new turn gives the client its quantum*/
+			if(client->deficit <= 0)
+				client->deficit = FILTER_QUANTUM;
+			
+			/*when the quantum is used up, the turn passes on*/
+			--client->deficit;
+			filter_turn[klass] = (client->deficit > 0) ? (client) : (client->next);
+			
+			return client;
+			}
+			
+		/*a client which cannot go now loses the rest of its turn*/
+		client->deficit = 0;
+		client = client->next;
+		}
+	while(client != filter_turn[klass]);
+	
+	return NULL;
+	}/*filter_client_pick*/
+/*----------------------------------------------------------------------------*/
+/*Takes the next job to start out of the queues; returns NULL if no queued
+	job may start now (the executor must be locked)*/
+static
+filter_job_t *
+filter_job_next(void)
+	{
+	/*The class of the job, the client and the job*/
+	int klass;
+	filter_client_t * client = NULL;
+	filter_job_t * job;
+	
+	/*Find the most urgent class which has a job to start and, in the
+		weighted mode, has not used up its share of the current round*/
+	for(klass = 0; klass < FILTER_CLASSES; ++klass)
+		if
+			(
+			((filter_priority == FILTER_PRIORITY_STRICT)
+				|| (filter_credits[klass] > 0))
+			&& ((client = filter_client_pick(klass)) != NULL)
+			)
+			break;
+	
+	/*If every class with jobs to start has used up its share, start a new
+		round and look again*/
+	if(!client)
+		{
+		for(klass = 0; klass < FILTER_CLASSES; ++klass)
+			filter_credits[klass] = filter_weights[klass];
+		for
+			(
+			klass = 0;
+			(klass < FILTER_CLASSES) && !(client = filter_client_pick(klass));
+			++klass
+			);
+		if(!client)
+			return NULL;
+		}
+	
+	/*Take the oldest job of the client*/
+	job = client->first;
+	client->first = job->next;
+	if(!client->first)
+		client->last = NULL;
+	++client->running;
+	--filter_credits[klass];
+		
+	return job;
+	}/*filter_job_next*/
+/*----------------------------------------------------------------------------*/
+/*Starts the commands of the queued jobs while there are free slots (see
+	below)*/
+static
+void
+filter_dispatch(void);
+/*----------------------------------------------------------------------------*/
+/*Waits for the command of `arg` (a running job) and completes the job; runs
+	in a thread of its own, one for each running command, so that the job
+	completes as soon as its process exits. Only the processes of the jobs
+	are waited for, so the other children of the translator are left to
+	whoever has created them.*/
+static
+any_t
+filter_waiter
+	(
+	any_t arg
+	)
+	{
+	/*The job*/
+	filter_job_t * job = arg;
+	
+	/*The exit status of the process*/
+	pid_t pid;
+	int status;
+	
+	/*Sleep until the process exits*/
+	do
+		pid = waitpid(job->pid, &status, 0);
+	while((pid < 0) && (errno == EINTR));
+	
+	mutex_lock(&filter_lock);
+	
+	/*The job is not running any more*/
+	--filter_running_count;
+	
+	/*A zero exit code means the file satisfies the property; if the process
+		cannot be waited for, the job fails*/
+	if(pid < 0)
+		job->err = errno;
+	else
+		job->good = WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+	job->done = 1;
+	condition_signal(&job->completed);
+	
+	/*See how many commands may run now*/
+	if((pid > 0) && (filter_concurrency > 0))
+		filter_adapt(job);
+	
+	/*The client has one job less*/
+	--job->client->running;
+	filter_client_put(job->client);
+	
+	/*The slot is free, start the next jobs*/
+	filter_dispatch();
+	
+	mutex_unlock(&filter_lock);
+	return 0;
+	}/*filter_waiter*/
+/*----------------------------------------------------------------------------*/
+/*Starts the commands of the queued jobs while there are free slots (the
+	executor must be locked; it is unlocked while a process is created)*/
+static
+void
+filter_dispatch(void)
+	{
+	/*The job being started*/
+	filter_job_t * job;
+	
+	/*The process running the command*/
+	pid_t pid;
+	
+	/*The bounds may have changed*/
+	if(filter_concurrency > 0)
+		filter_limit_clamp();
+	
+	while((filter_concurrency <= 0) || (filter_running_count < filter_limit))
+		{
+		/*take the next job, if there is one, and its slot*/
+		job = filter_job_next();
+		if(!job)
+			break;
+		++filter_running_count;
+		job->saturated = (filter_running_count >= filter_limit);
+		
+		/*start the command in the same way system() does, but without
+			waiting for it; the other threads need not wait for the creation of
+			the process*/
+		mutex_unlock(&filter_lock);
+		pid = fork();
+		if(pid == 0)
+			{
+			execl("/bin/sh", "sh", "-c", job->cmd, NULL);
+			_exit(127);
+			}
+		job->err = (pid < 0) ? (errno) : (0);
+		mutex_lock(&filter_lock);
+		
+		/*if the process could not be created, the job fails*/
+		if(pid < 0)
+			{
+			--filter_running_count;
+			job->done = 1;
+			condition_signal(&job->completed);
+			--job->client->running;
+			filter_client_put(job->client);
+			continue;
+			}
+			
+		/*the job is running now; its own thread waits for it*/
+		job->pid = pid;
+		job->start = filter_now();
+		cthread_detach(cthread_fork(filter_waiter, job));
+		}
+	}/*filter_dispatch*/
+/*----------------------------------------------------------------------------*/
+/*Prepares the executor; there is nothing to start, since each command is
+	waited for by a thread of its own*/
+error_t
+filter_init(void)
+	{
+	return 0;
+	}/*filter_init*/
+/*----------------------------------------------------------------------------*/
+/*Returns the user on whose behalf `user` requests filter work*/
+uid_t
+filter_uid
+	(
+	struct iouser * user
+	)
+	{
+	/*The first effective uid identifies the user*/
+	return (user && user->uids && (user->uids->num > 0))
+		? (user->uids->ids[0]) : (FILTER_UID_NONE);
+	}/*filter_uid*/
+/*----------------------------------------------------------------------------*/
+/*Queues the check of the file `name` in the directory `dir_path` against
+	the property of the rule `rule` (see lnode_rule) in the class `klass` on
+	behalf of the user `uid`; the command is started as soon as there is a
+	free slot, no more urgent work, and it is the turn of the user. The job
+	must be given to filter_wait.*/
+error_t
+filter_submit
+	(
+	const char * dir_path,
+	const char * name,
+	int rule,
+	int klass,
+	uid_t uid,
+	filter_job_t ** job
+	)
+	{
+	/*The client submitting the job*/
+	filter_client_t * client;
+	
+	/*The property the file is checked against*/
+	filter_property_t * prop;
+	
+	/*Create the job*/
+	filter_job_t * job_new = calloc(1, sizeof(filter_job_t));
+	if(!job_new)
+		return ENOMEM;
+	condition_init(&job_new->completed);
+		
+	mutex_lock(&filter_lock);
+	
+	/*Pick the property of the rule; a rule resolved under a table which has
+		been replaced since may point anywhere, but its verdict will be stale
+		anyway*/
+	if(rule == FILTER_RULE_ACCEPT)
+		prop = NULL;
+	else if((rule >= 0) && (rule < filter_rules_count))
+		prop = filter_rules[rule].property;
+	else
+		prop = filter_property;
+	
+	/*If there is no property, any name is OK, there is nothing to run*/
+	if(!prop)
+		{
+		mutex_unlock(&filter_lock);
+		job_new->good = job_new->done = 1;
+		*job = job_new;
+		return 0;
+		}
+	
+	/*Build the command under the property in force now; it is not affected
+		by later changes of the property*/
+	job_new->cmd = filter_cmd_build(prop, dir_path, name);
+	if(!job_new->cmd)
+		{
+		mutex_unlock(&filter_lock);
+		free(job_new);
+		return ENOMEM;
+		}
+	
+	/*Find the client of the user in the class*/
+	client = filter_client_get(uid, klass);
+	if(!client)
+		{
+		mutex_unlock(&filter_lock);
+		free(job_new->cmd);
+		free(job_new);
+		return ENOMEM;
+		}
+	job_new->client = client;
+	
+	/*Queue the job and start it, if it may go now*/
+	if(client->last)
+		client->last->next = job_new;
+	else
+		client->first = job_new;
+	client->last = job_new;
+	filter_dispatch();
+	
+	mutex_unlock(&filter_lock);
+	
+	*job = job_new;
+	return 0;
+	}/*filter_submit*/
+/*----------------------------------------------------------------------------*/
+/*Waits for `job` to complete (the calling thread just sleeps, no process is
+	waited for here), stores the verdict in `good` and frees the job*/
+error_t
+filter_wait
+	(
+	filter_job_t * job,
+	int * good
+	)
+	{
+	error_t err;
+	
+	/*Sleep until the job completes*/
+	mutex_lock(&filter_lock);
+	while(!job->done)
+		condition_wait(&job->completed, &filter_lock);
+	mutex_unlock(&filter_lock);
+	
+	/*Take the result*/
+	err = job->err;
+	*good = job->good;
+	
+	/*Free the job*/
+	free(job->cmd);
+	free(job);
+	
+	return err;
+	}/*filter_wait*/
+/*----------------------------------------------------------------------------*/
+/*Runs the filtering command of the rule `rule` on the file `name` in the
+	directory `dir_path` in the class `klass` on behalf of the user `uid`;
+	stores in `good` a nonzero value if the file satisfies the property*/
+error_t
+filter_check
+	(
+	const char * dir_path,
+	const char * name,
+	int rule,
+	int klass,
+	uid_t uid,
+	int * good
+	)
+	{
+	filter_job_t * job;
+	
+	/*Queue the job and wait for it*/
+	error_t err = filter_submit(dir_path, name, rule, klass, uid, &job);
+	if(!err)
+		err = filter_wait(job, good);
+		
+	return err;
+	}/*filter_check*/
+/*----------------------------------------------------------------------------*/
+/*Makes `text` the property (an empty or NULL one accepts every file). The
+	swap is atomic: the jobs submitted before it complete under the old
+	property, and the epoch of the property changes, so every verdict
+	obtained before is found out to be stale when it is next used*/
+error_t
+filter_property_set
+	(
+	const char * text
+	)
+	{
+	error_t err;
+	
+	/*The new property and the old one*/
+	filter_property_t * prop = NULL, * prop_old;
+	
+	/*Prepare the new property without holding the lock*/
+	if(text && *text)
+		{
+		err = filter_property_compile(text, &prop);
+		if(err)
+			return err;
+		}
+		
+	/*Swap the properties; the commands of the jobs submitted so far have
+		been built already*/
+	mutex_lock(&filter_lock);
+	prop_old = filter_property;
+	filter_property = prop;
+	++property_epoch;
+	mutex_unlock(&filter_lock);
+	
+	filter_property_free(prop_old);
+	
+	LOG_MSG("filter_property_set: The property is now '%s'.",
+		(text) ? (text) : (""));
+	return 0;
+	}/*filter_property_set*/
+/*----------------------------------------------------------------------------*/
+/*Returns a copy of the text of the property (NULL if there is none or there
+	is not enough memory), which the caller must free*/
+char *
+filter_property_get(void)
+	{
+	char * text = NULL;
+	
+	mutex_lock(&filter_lock);
+	if(filter_property)
+		text = strdup(filter_property->text);
+	mutex_unlock(&filter_lock);
+	
+	return text;
+	}/*filter_property_get*/
+/*----------------------------------------------------------------------------*/
+/*Frees the table of `count` rules `rules`*/
+static
+void
+filter_rules_free
+	(
+	filter_rule_t * rules,
+	int count
+	)
+	{
+	int i;
+	
+	for(i = 0; i < count; ++i)
+		{
+		free(rules[i].prefix);
+		filter_property_free(rules[i].property);
+		}
+	free(rules);
+	}/*filter_rules_free*/
+/*----------------------------------------------------------------------------*/
+/*Replaces the table of rules with `rules` (`count` strings of the form
+	PREFIX:PROPERTY, the prefix being relative to the directory being
+	filtered); the swap is atomic, like that of the property*/
+error_t
+filter_rules_set
+	(
+	char * const * rules,
+	int count
+	)
+	{
+	error_t err = 0;
+	
+	/*The new table and the old one, with their sizes*/
+	filter_rule_t * table = NULL, * table_old;
+	int count_old, i;
+	
+	/*The bounds of the prefix and the property in the current rule*/
+	const char * prefix, * colon;
+	size_t prefix_len;
+	
+	/*Prepare the new table without holding the lock*/
+	if(count > 0)
+		{
+		table = calloc(count, sizeof(filter_rule_t));
+		if(!table)
+			return ENOMEM;
+		}
+	for(i = 0; !err && (i < count); ++i)
+		{
+		/*the prefix ends at the first colon*/
+		colon = strchr(rules[i], ':');
+		if(!colon)
+			{
+			err = EINVAL;
+			break;
+			}
+			
+		/*store it without the slashes around it*/
+		for(prefix = rules[i]; *prefix == '/'; ++prefix);
+		prefix_len = colon - prefix;
+		while(prefix_len && (prefix[prefix_len - 1] == '/'))
+			--prefix_len;
+		table[i].prefix = strndup(prefix, prefix_len);
+		if(!table[i].prefix)
+			err = ENOMEM;
+			
+		/*an empty property accepts everything in the subtree*/
+		if(!err && colon[1])
+			err = filter_property_compile(colon + 1, &table[i].property);
+		}
+	if(err)
+		{
+		filter_rules_free(table, count);
+		return err;
+		}
+		
+	/*Swap the tables*/
+	mutex_lock(&filter_lock);
+	table_old = filter_rules;
+	count_old = filter_rules_count;
+	filter_rules = table;
+	filter_rules_count = count;
+	++property_epoch;
+	mutex_unlock(&filter_lock);
+	
+	filter_rules_free(table_old, count_old);
+	
+	LOG_MSG("filter_rules_set: %d rules installed.", count);
+	return 0;
+	}/*filter_rules_set*/
+/*----------------------------------------------------------------------------*/
+/*Returns the index of the rule of the subtree rooted at `path` (relative to
+	the directory being filtered, without leading slashes), or
+	FILTER_RULE_NONE if there is no such rule*/
+int
+filter_rule_find
+	(
+	const char * path
+	)
+	{
+	int rule = FILTER_RULE_NONE, i;
+	
+	mutex_lock(&filter_lock);
+	for(i = 0; i < filter_rules_count; ++i)
+		if(strcmp(filter_rules[i].prefix, path) == 0)
+			{
+			rule = i;
+			break;
+			}
+	mutex_unlock(&filter_lock);
+	
+	return rule;
+	}/*filter_rule_find*/
+/*----------------------------------------------------------------------------*/
+/*Returns a copy of the rule number `i` in the form PREFIX:PROPERTY (NULL if
+	there is no such rule or there is not enough memory), which the caller
+	must free*/
+char *
+filter_rule_get
+	(
+	int i
+	)
+	{
+	char * text = NULL;
+	
+	mutex_lock(&filter_lock);
+	if((i >= 0) && (i < filter_rules_count))
+		{
+		if
+			(
+			asprintf
+				(
+				&text, "%s:%s", filter_rules[i].prefix,
+				(filter_rules[i].property) ? (filter_rules[i].property->text) : ("")
+				) < 0
+			)
+			text = NULL;
+		}
+	mutex_unlock(&filter_lock);
+	
+	return text;
+	}/*filter_rule_get*/
+/*----------------------------------------------------------------------------*/
+/*Turns the inheritance of the verdicts on directories on or off; the rules
+	resolved so far become stale, like after a change of the property*/
+void
+filter_prune_set
+	(
+	int prune
+	)
+	{
+	mutex_lock(&filter_lock);
+	if(filter_prune != prune)
+		{
+		filter_prune = prune;
+		++property_epoch;
+		}
+	mutex_unlock(&filter_lock);
+	}/*filter_prune_set*/
+/*----------------------------------------------------------------------------*/
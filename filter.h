@@ -0,0 +1,332 @@
+/*----------------------------------------------------------------------------*/
+/*filter.h*/
+/*----------------------------------------------------------------------------*/
+/*Checking the property of files*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+/*----------------------------------------------------------------------------*/
+#include <error.h>
+#include <sys/types.h>
+#include <cthreads.h>
+#include <hurd/iohelp.h>
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*The default bounds of the number of filtering commands running at once and
+	the number the adaptation starts from*/
+#define FILTER_CONCURRENCY 16
+#define FILTER_CONCURRENCY_MIN 1
+#define FILTER_CONCURRENCY_INITIAL 4
+/*----------------------------------------------------------------------------*/
+/*The default latency of a filtering command (in milliseconds) above which
+	fewer commands are run at once; 0 means FILTER_LATENCY_TOLERANCE times
+	the lowest latency observed*/
+#define FILTER_TARGET_LATENCY 0
+#define FILTER_LATENCY_TOLERANCE 2
+/*----------------------------------------------------------------------------*/
+/*The number of completed commands after which the lowest latency observed is
+	forgotten, so that it follows the changes of the filter*/
+#define FILTER_BASELINE_SAMPLES 1024
+/*----------------------------------------------------------------------------*/
+/*A decrease of the number of commands running at once removes this part of
+	them*/
+#define FILTER_DECREASE 4
+/*----------------------------------------------------------------------------*/
+/*The classes of filter work, the most urgent first*/
+#define FILTER_CLASS_LOOKUP 0 /*a client opening a file*/
+#define FILTER_CLASS_LISTING 1 /*a client listing a directory*/
+#define FILTER_CLASS_BACKGROUND 2 /*prefetching and revalidation*/
+#define FILTER_CLASSES 3
+/*----------------------------------------------------------------------------*/
+/*The ways of choosing the class of the next job to start*/
+#define FILTER_PRIORITY_STRICT 0 /*a more urgent class always goes first*/
+#define FILTER_PRIORITY_WEIGHTED 1 /*the classes share the slots by weight*/
+/*----------------------------------------------------------------------------*/
+/*The default way of choosing the class*/
+#define FILTER_PRIORITY FILTER_PRIORITY_WEIGHTED
+/*----------------------------------------------------------------------------*/
+/*The numbers of jobs of each class started in one round of the weighted
+	scheduling*/
+#define FILTER_WEIGHT_LOOKUP 16
+#define FILTER_WEIGHT_LISTING 4
+#define FILTER_WEIGHT_BACKGROUND 1
+/*----------------------------------------------------------------------------*/
+/*The number of jobs a client may start in one turn of the round robin among
+	the clients of a class*/
+#define FILTER_QUANTUM 4
+/*----------------------------------------------------------------------------*/
+/*The default maximal number of filtering commands running at once on
+	behalf of one user (0 means no limit)*/
+#define FILTER_USER_CONCURRENCY 0
+/*----------------------------------------------------------------------------*/
+/*The user on whose behalf the work not requested by any client is done*/
+#define FILTER_UID_NONE ((uid_t)-1)
+/*----------------------------------------------------------------------------*/
+/*The rule applying to the entries of a directory, besides the indices in
+	the table of rules: the property given by --property, none, when the
+	directory takes the rule of its parent, or the acceptance of every entry,
+	when the directory inherits its own verdict (see filter_prune)*/
+#define FILTER_RULE_DEFAULT (-1)
+#define FILTER_RULE_NONE (-2)
+#define FILTER_RULE_ACCEPT (-3)
+/*----------------------------------------------------------------------------*/
+/*Whether the verdicts on directories are inherited by their subtrees by
+	default*/
+#define FILTER_PRUNE 0
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Types---------------------------------------------------------------*/
+/*A user whose jobs of one class are queued or running*/
+struct filter_client
+	{
+	/*the user and the class*/
+	uid_t uid;
+	int klass;
+	
+	/*the queued jobs of the user, the oldest first*/
+	struct filter_job * first, * last;
+	
+	/*the number of jobs the client may still start in its current turn*/
+	int deficit;
+	
+	/*the number of running jobs of the client*/
+	int running;
+	
+	/*the next client of the same class in the round robin*/
+	struct filter_client * next;
+	};/*struct filter_client*/
+/*----------------------------------------------------------------------------*/
+typedef struct filter_client filter_client_t;
+/*----------------------------------------------------------------------------*/
+/*A check of a file against the property (a job of the executor)*/
+struct filter_job
+	{
+	/*the filtering command*/
+	char * cmd;
+	
+	/*the client which has submitted the job*/
+	filter_client_t * client;
+	
+	/*the process running the command (0 while the job is queued)*/
+	pid_t pid;
+	
+	/*the time the command was started (in microseconds) and whether it took
+		the last free slot*/
+	long long start;
+	int saturated;
+	
+	/*nonzero when the job has completed; the verdict and the error which has
+		occurred*/
+	int done;
+	int good;
+	error_t err;
+	
+	/*signalled when the job completes (only the thread waiting for this job
+		is woken up)*/
+	struct condition completed;
+	
+	/*the next job in the queue*/
+	struct filter_job * next;
+	};/*struct filter_job*/
+/*----------------------------------------------------------------------------*/
+typedef struct filter_job filter_job_t;
+/*----------------------------------------------------------------------------*/
+/*A piece of the property between two occurrences of PROPERTY_PARAM*/
+struct filter_piece
+	{
+	/*the beginning of the piece in the text of the property*/
+	const char * start;
+	
+	/*the length of the piece*/
+	size_t len;
+	};/*struct filter_piece*/
+/*----------------------------------------------------------------------------*/
+typedef struct filter_piece filter_piece_t;
+/*----------------------------------------------------------------------------*/
+/*The property, split at the occurrences of PROPERTY_PARAM once, when it is
+	set, so that the commands are built without searching it*/
+struct filter_property
+	{
+	/*the property as given by the user*/
+	char * text;
+	
+	/*the pieces between the occurrences of PROPERTY_PARAM (one more than
+		the occurrences), their number and their total length*/
+	filter_piece_t * pieces;
+	int pieces_count;
+	size_t pieces_len;
+	};/*struct filter_property*/
+/*----------------------------------------------------------------------------*/
+typedef struct filter_property filter_property_t;
+/*----------------------------------------------------------------------------*/
+/*A rule: the property applying to a subtree instead of the default one*/
+struct filter_rule
+	{
+	/*the path to the root of the subtree, relative to the directory being
+		filtered, without leading or trailing slashes*/
+	char * prefix;
+	
+	/*the property of the subtree (NULL if every file is accepted)*/
+	filter_property_t * property;
+	};/*struct filter_rule*/
+/*----------------------------------------------------------------------------*/
+typedef struct filter_rule filter_rule_t;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The epoch of the property: it changes whenever the property changes, so
+	that verdicts obtained under an older property are not trusted*/
+extern unsigned long property_epoch;
+/*----------------------------------------------------------------------------*/
+/*Whether the verdicts on directories are inherited by their subtrees: an
+	accepted directory shows everything below it unfiltered (a rejected one
+	hides its subtree anyway), so only the entries of the root and of the
+	subtrees with rules of their own are given to the filter*/
+extern int filter_prune;
+/*----------------------------------------------------------------------------*/
+/*The bounds of the number of filtering commands running at once and the
+	target latency of a command in milliseconds (may be overwritten by the
+	user)*/
+extern int filter_concurrency;
+extern int filter_concurrency_min;
+extern int filter_target_latency;
+/*----------------------------------------------------------------------------*/
+/*The way of choosing the class of the next job (may be overwritten by the
+	user)*/
+extern int filter_priority;
+/*----------------------------------------------------------------------------*/
+/*The maximal number of filtering commands running at once on behalf of one
+	user (may be overwritten by the user)*/
+extern int filter_user_concurrency;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Prepares the executor; there is nothing to start, since each command is
+	waited for by a thread of its own*/
+error_t
+filter_init(void);
+/*----------------------------------------------------------------------------*/
+/*Returns the user on whose behalf `user` requests filter work*/
+uid_t
+filter_uid
+	(
+	struct iouser * user
+	);
+/*----------------------------------------------------------------------------*/
+/*Queues the check of the file `name` in the directory `dir_path` against
+	the property of the rule `rule` (see lnode_rule) in the class `klass` on
+	behalf of the user `uid`; the command is started as soon as there is a
+	free slot, no more urgent work, and it is the turn of the user. The job
+	must be given to filter_wait.*/
+error_t
+filter_submit
+	(
+	const char * dir_path,
+	const char * name,
+	int rule,
+	int klass,
+	uid_t uid,
+	filter_job_t ** job
+	);
+/*----------------------------------------------------------------------------*/
+/*Waits for `job` to complete (the calling thread just sleeps, no process is
+	waited for here), stores the verdict in `good` and frees the job*/
+error_t
+filter_wait
+	(
+	filter_job_t * job,
+	int * good
+	);
+/*----------------------------------------------------------------------------*/
+/*Runs the filtering command of the rule `rule` on the file `name` in the
+	directory `dir_path` in the class `klass` on behalf of the user `uid`;
+	stores in `good` a nonzero value if the file satisfies the property*/
+error_t
+filter_check
+	(
+	const char * dir_path,
+	const char * name,
+	int rule,
+	int klass,
+	uid_t uid,
+	int * good
+	);
+/*----------------------------------------------------------------------------*/
+/*Makes `text` the property (an empty or NULL one accepts every file). The
+	swap is atomic: the jobs submitted before it complete under the old
+	property, and the epoch of the property changes, so every verdict
+	obtained before is found out to be stale when it is next used*/
+error_t
+filter_property_set
+	(
+	const char * text
+	);
+/*----------------------------------------------------------------------------*/
+/*Returns a copy of the text of the property (NULL if there is none or there
+	is not enough memory), which the caller must free*/
+char *
+filter_property_get(void);
+/*----------------------------------------------------------------------------*/
+/*Replaces the table of rules with `rules` (`count` strings of the form
+	PREFIX:PROPERTY, the prefix being relative to the directory being
+	filtered); the swap is atomic, like that of the property*/
+error_t
+filter_rules_set
+	(
+	char * const * rules,
+	int count
+	);
+/*----------------------------------------------------------------------------*/
+/*Returns the index of the rule of the subtree rooted at `path` (relative to
+	the directory being filtered, without leading slashes), or
+	FILTER_RULE_NONE if there is no such rule*/
+int
+filter_rule_find
+	(
+	const char * path
+	);
+/*----------------------------------------------------------------------------*/
+/*Returns a copy of the rule number `i` in the form PREFIX:PROPERTY (NULL if
+	there is no such rule or there is not enough memory), which the caller
+	must free*/
+char *
+filter_rule_get
+	(
+	int i
+	);
+/*----------------------------------------------------------------------------*/
+/*Turns the inheritance of the verdicts on directories on or off; the rules
+	resolved so far become stale, like after a change of the property*/
+void
+filter_prune_set
+	(
+	int prune
+	);
+/*----------------------------------------------------------------------------*/
+#endif /*__FILTER_H__*/
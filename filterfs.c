@@ -38,6 +38,14 @@
 #include "debug.h"
 #include "options.h"
 #include "ncache.h"
+#include "pcache.h"
+#include "readahead.h"
+#include "bcache.h"
+#include "writeback.h"
+#include "filter.h"
+#include "prefetch.h"
+#include "refresh.h"
+#include "notify.h"
 /*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
@@ -73,6 +81,10 @@ pid_t fsid;
 /*The file to print debug messages to*/
 FILE * filterfs_dbg;
 /*----------------------------------------------------------------------------*/
+/*The size of reads starting with which the data are forwarded without
+	copying*/
+size_t zero_copy_min = FILTERFS_ZERO_COPY_MIN;
+/*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Functions-----------------------------------------------------------*/
@@ -209,8 +221,24 @@ netfs_validate_stat
 	/*If we are not at the root*/
 	if(np != netfs_root_node)
 		{
-		/*If the node is not surely up-to-date*/
-		if(!(np->nn->flags & FLAG_NODE_ULFS_UPTODATE))
+		/*The buffered data must reach the file before its size is asked for*/
+		writeback_flush(np);
+		
+		/*If the attributes have been cached recently, there is no need to ask
+			the underlying filesystem*/
+		if(lnode_stat_fetch(np->nn->lnode, &np->nn_stat) == 0)
+			{
+			np->nn_translated = np->nn_stat.st_mode;
+			return 0;
+			}
+
+		/*If the node is not surely up-to-date (the cache might have been
+			invalidated since the node was last updated)*/
+		if
+			(
+			!(np->nn->flags & FLAG_NODE_ULFS_UPTODATE)
+			|| (np->nn->generation != lnode_generation(np->nn->lnode))
+			)
 			{
 			/*update it*/
 			err = node_update(np);
@@ -239,23 +267,11 @@ netfs_validate_stat
 					we will open the port and close it after the stat, so that additional
 					resources are not consumed.*/
 				
-				/*the parent node of the current node*/
-				node_t * dnp;
-
-				/*obtain the parent node of the the current node*/
-				err = ncache_node_lookup(np->nn->lnode->dir, &dnp);
-				
-				/*the lookup should never fail here*/
-				assert(!err);
-				
-				/*open a port to the file we are interested in*/
-				mach_port_t p = file_name_lookup_under
-					(dnp->nn->port, np->nn->lnode->name, 0, 0);
-	
-				/*put `dnp` back, since we don't need it any more*/
-				netfs_nput(dnp);
-
-				if(!p)
+				/*open a port to the file we are interested in (in the
+					underlying directory pinned in the lnode, without locking the
+					parent node)*/
+				mach_port_t p;
+				if(node_port_open(np, 0, &p) != 0)
 					return EBADF;
 				
 				/*try to stat the node*/
@@ -264,12 +280,16 @@ netfs_validate_stat
 				/*deallocate the port*/
 				PORT_DEALLOC(p);
 				}
+				
+			/*If the attributes have been obtained, cache them*/
+			if(!err)
+				lnode_stat_store(np->nn->lnode, &np->nn_stat);
 			}
 		}
 	/*If we are at the root*/
 	else
 		/*put the size of the node into the stat structure belonging to `np`*/
-		node_get_size(np, (OFFSET_T *)&np->nn_stat.st_size);
+		node_get_size(np, filter_uid(cred), (OFFSET_T *)&np->nn_stat.st_size);
 
 	/*Return the result of operations*/
 	return err;
@@ -286,8 +306,18 @@ netfs_attempt_sync
 	{
 	LOG_MSG("netfs_attempt_sync");
 
-	/*Operation is not supported*/
-	return EOPNOTSUPP;
+	error_t err = 0;
+	
+	/*Write out the buffered data and report any failed write*/
+	err = writeback_sync(node);
+	
+	/*Ask the underlying file to sync itself, if it is open (if it is not,
+		it has not been written through us since the port was closed)*/
+	if(!err && !NODE_IS_ROOT(node) && (node->nn->port != MACH_PORT_NULL))
+		err = file_sync(node->nn->port, wait, 0);
+
+	/*Return the result of syncing*/
+	return err;
 	}/*netfs_attempt_sync*/
 /*----------------------------------------------------------------------------*/
 /*Fetches a directory*/
@@ -419,11 +449,21 @@ netfs_get_dirents
 		}/*add_dirent*/
 	
 	/*List the dirents for node `dir`*/
-	err = node_entries_get(dir, &dirent_list);
+	err = node_entries_get
+		(dir, filter_uid(cred), FILTER_CLASS_LISTING, &dirent_list, 1);
 	
 	/*If listing was successful*/
 	if(!err)
 		{
+		/*once per listing, not for every chunk of it: the subdirectories
+			will probably be entered next, so prepare their verdicts in the
+			background, and keep the directory fresh if it is listed often*/
+		if(first_entry == 0)
+			{
+			prefetch_children(dir, dirent_list, 1);
+			refresh_note(dir);
+			}
+		
 		/*find the entry whose number is `first_entry`*/
 		for
 			(
@@ -496,9 +536,7 @@ netfs_get_dirents
 				break;
 		}
 		
-	/*If the list of dirents has been allocated, free it*/
-	if(dirent_list)
-		node_entries_free(dirent_list);
+	/*The list of dirents is kept in the node, it must not be freed*/
 		
 	/*The directory has been read right now, modify the access time*/
 	fshelp_touch(&dir->nn_stat, TOUCH_ATIME, maptime);
@@ -558,112 +596,111 @@ netfs_attempt_lookup
 		return err;
 		}
 
-	/*Checks whether the given name satisfied the required property*/
-	int
-	check_property
-		(
-		const char * name
-		)
+	/*The lnode corresponding to the entry we are supposed to fetch*/
+	lnode_t * lnode;
+	
+	/*The stat information about the file and whether it can be cached*/
+	io_statbuf_t stat;
+	int stat_valid = 0;
+	
+	/*The validity token of verdicts: the modification time of the directory
+		and the epoch of the property*/
+	struct timespec dir_mtime;
+	int token_valid = (node_dir_mtime_get(dir, &dir_mtime) == 0);
+	unsigned long epoch = lnode_epoch(dir->nn->lnode);
+	
+	/*The verdict on the entry*/
+	int verdict = LNODE_VERDICT_UNKNOWN, good = 0;
+	
+	/*The evaluation of the filter on this name in progress*/
+	node_flight_t * flight;
+	
+	/*The copy of the path to the directory (its lock is released while the
+		filter runs) and the rule applying to its entries*/
+	char * dir_path;
+	int rule;
+	
+	/*If the entry has been seen before (typically, in a listing), the verdict
+		on it may still hold, and its attributes may be known*/
+	if(lnode_get(dir->nn->lnode, name, &lnode) == 0)
 		{
-		/*If there is no property*/
-		if(!property)
-			/*no filtering will be applied, any name is OK*/
-			return 0;
-		
-		/*The number of occurrences of PROPERTY_PARAM in the property*/
-		int param_entries_count = 0;
-
-		/*The pointer to the current occurrence of PROPERTY_PARAM*/
-		char * occurrence = strstr(property, PROPERTY_PARAM);
-		
-		/*Count the number of occurrences*/
-		for(; occurrence;
-			occurrence = strstr(occurrence + 1, PROPERTY_PARAM),
-			++param_entries_count);
-		
-		/*Compute the length of the property param*/
-		size_t property_param_len = strlen(PROPERTY_PARAM);
+		if(token_valid)
+			verdict = lnode_verdict_fetch(lnode, dir_mtime, epoch);
+		if(verdict == LNODE_VERDICT_GOOD)
+			stat_valid = (lnode_stat_fetch(lnode, &stat) == 0);
+		lnode_ref_remove(lnode);
+		}
 		
-		/*The length of the property*/
-		size_t property_len = (property) ? (strlen(property)) : (0);
+	/*The listing of the directory, which change notifications keep valid,
+		may know the entry, too*/
+	if((verdict == LNODE_VERDICT_UNKNOWN) && token_valid)
+		verdict = node_verdict_lookup(dir, name, dir_mtime, epoch);
 	
-		/*Everything OK at first*/
-		err = 0;
-		
-		/*Compute the length of the full name once*/
-		size_t full_name_len = strlen(dir->nn->lnode->path) + 1 + strlen(name) + 1;
-		
-		/*Try to allocate the required space*/
-		char * full_name = malloc(full_name_len);
-		if(!full_name)
+	/*Only a name never seen (or seen before the directory or the property
+		changed) is given to the filter*/
+	if(verdict == LNODE_VERDICT_UNKNOWN)
+		{
+		/*If another thread is checking the same name, wait for its verdict*/
+		flight = node_flight_find(dir, name);
+		if(flight)
 			{
-			err = ENOMEM;
-			return 0;
+			node_flight_wait(dir, flight);
+			err = flight->err;
+			good = flight->good;
+			node_flight_release(flight);
 			}
-		
-		/*Initialize `full_name` as a valid string*/
-		full_name[0] = 0;
-		
-		/*Construct the full name*/
-		strcpy(full_name, dir->nn->lnode->path);
-		strcat(full_name, "/");
-		strcat(full_name, name);
-		
-		LOG_MSG("netfs_attempt_lookup: Applying filter to %s...", full_name);
-		
-		/*Compute the space required for the final filtering command*/
-		size_t sz = property_len + (strlen(full_name) - property_param_len)
-			* param_entries_count;
-		
-		/*Try to allocate the space for the command*/
-		char * cmd = malloc(sz);
-		if(!cmd)
+		else
 			{
-			free(full_name);
-			err = ENOMEM;
-			return 0;
-			}
-		
-		/*Initialize `cmd` as a valid string*/
-		cmd[0] = 0;
+			LOG_MSG("netfs_attempt_lookup: Applying filter to %s/%s...",
+				dir->nn->lnode->path, name);
 			
-		/*The current occurence of PROPERTY_PARAM in property*/
-		char * p = strstr(property, PROPERTY_PARAM);
-		
-		/*The pointer to the current position in the property*/
-		char * propp = property;
-		
-		/*While the command has not been constructed*/
-		for(; p; p = strstr(propp, PROPERTY_PARAM))
-			{
-			/*add the new part of the property to the command*/
-			strncat(cmd, propp, p - propp);
+			/*let other threads wait for this check, and run the filter without
+				holding the lock of the directory*/
+			err = lnode_rule(dir->nn->lnode, &rule);
+			if(err)
+				{
+				mutex_unlock(&dir->lock);
+				return err;
+				}
+			dir_path = strdup(dir->nn->lnode->path);
+			if(!dir_path)
+				{
+				mutex_unlock(&dir->lock);
+				return ENOMEM;
+				}
+			flight = node_flight_start(dir, name);
+			mutex_unlock(&dir->lock);
 			
-			/*add the filename to the command*/
-			strcat(cmd, full_name);
+			err = filter_check
+				(
+				dir_path, name, rule, FILTER_CLASS_LOOKUP, filter_uid(user),
+				&good
+				);
 			
-			/*LOG_MSG("\tcmd = '%s'", cmd);*/
-
-			/*advance the pointer in the property*/
-			propp = p + property_param_len;
-
-			/*LOG_MSG("\tpropp points at '%s'", propp);*/
+			mutex_lock(&dir->lock);
+			if(flight)
+				node_flight_land(dir, flight, good, err);
+			free(dir_path);
 			}
 		
-		/*Copy the rest of the property to the command*/
-		strcat(cmd, propp);
-		
-		/*LOG_MSG("node_entries_get: The filtering command: '%s'.", cmd);*/
-
-		/*Execute the command*/
-		int xcode = WEXITSTATUS(system(cmd));
+		if(err)
+			{
+			mutex_unlock(&dir->lock);
+			return err;
+			}
+		verdict = (good) ? (LNODE_VERDICT_GOOD) : (LNODE_VERDICT_BAD);
 		
-		/*Return the exit code of the command*/
-		return xcode;
-		}/*check_property*/
+		/*record the verdict, if there is somewhere to put it (a good entry
+			gets its verdict recorded together with its new lnode below)*/
+		if(!good && token_valid && (lnode_get(dir->nn->lnode, name, &lnode) == 0))
+			{
+			lnode_verdict_store(lnode, 0, dir_mtime, epoch);
+			lnode_ref_remove(lnode);
+			}
+		}
 
 	/*If the given name does not satisfy the property*/
-	if(check_property(name) != 0)
+	if(verdict != LNODE_VERDICT_GOOD)
 		{
 		/*unlock the directory*/
 		mutex_unlock(&dir->lock);
@@ -672,25 +709,42 @@ netfs_attempt_lookup
 		return ENOENT;
 		}
 
-	/*Try to lookup the given file in the underlying directory*/
-	mach_port_t p = file_name_lookup_under(dir->nn->port, name, 0, 0);
-	
-	/*If the lookup failed*/
-	if(p == MACH_PORT_NULL)
+	/*Make sure the port to the underlying directory is open*/
+	err = node_port_ensure(dir, O_READ | O_DIRECTORY);
+	if(err)
 		{
-		/*unlock the directory*/
 		mutex_unlock(&dir->lock);
-
-		/*no such entry*/
-		return ENOENT;
+		return err;
 		}
 
-	/*Obtain the stat information about the file*/
-	io_statbuf_t stat;
-	err = io_stat(p, &stat);
-	
-	/*Deallocate the obtained port*/
-	PORT_DEALLOC(p);
+	/*The port to the file*/
+	mach_port_t p;
+
+	/*If the attributes are not known, ask the underlying filesystem*/
+	if(!stat_valid)
+		{
+		/*Try to lookup the given file in the underlying directory*/
+		p = file_name_lookup_under(dir->nn->port, name, 0, 0);
+		
+		/*If the lookup failed*/
+		if(p == MACH_PORT_NULL)
+			{
+			/*unlock the directory*/
+			mutex_unlock(&dir->lock);
+
+			/*no such entry*/
+			return ENOENT;
+			}
+
+		/*Obtain the stat information about the file*/
+		err = io_stat(p, &stat);
+		
+		/*Remember whether the stat information can be cached*/
+		stat_valid = !err;
+		
+		/*Deallocate the obtained port*/
+		PORT_DEALLOC(p);
+		}
 
 	/*If this file is not a directory*/
 	if(err || !S_ISDIR(stat.st_mode))
@@ -704,13 +758,11 @@ netfs_attempt_lookup
 		p = file_name_lookup_under(dir->nn->port, name, O_READ | O_DIRECTORY, 0);
 		if(p == MACH_PORT_NULL)
 			{
+			mutex_unlock(&dir->lock);
 			return EBADF; /*not enough rights?*/
 			}
 		}
 
-	/*The lnode corresponding to the entry we are supposed to fetch*/
-	lnode_t * lnode;
-	
 	/*Finalizes the execution of this function*/
 	void
 	finalize(void)
@@ -757,6 +809,25 @@ netfs_attempt_lookup
 		/*install the new lnode into the directory*/
 		lnode_install(dir->nn->lnode, lnode);
 		}
+		
+	/*Cache the attributes obtained during the lookup, so that the stat which
+		usually follows is served without talking to the underlying filesystem*/
+	if(stat_valid)
+		lnode_stat_store(lnode, &stat);
+		
+	/*Record the verdict, so that the filter is not run on this name again
+		while the directory and the property stay the same*/
+	if(token_valid)
+		lnode_verdict_store(lnode, 1, dir_mtime, epoch);
+	
+	/*Pin the underlying directory in the lnode, so that the file can be
+		reopened without locking `dir` (whose port may be evicted meanwhile)*/
+	if(lnode->dir_port == MACH_PORT_NULL)
+		{
+		mach_port_mod_refs
+			(mach_task_self(), dir->nn->port, MACH_PORT_RIGHT_SEND, 1);
+		lnode->dir_port = dir->nn->port;
+		}
 	
 	/*Obtain the node corresponding to this lnode*/
 	err = ncache_node_lookup(lnode, node);
@@ -772,8 +843,12 @@ netfs_attempt_lookup
 		return err;
 		}
 
-	/*Store the port in the node*/
-	(*node)->nn->port = p;
+	/*Store the port in the node (directories only), the node owns it now*/
+	if(p != MACH_PORT_NULL)
+		{
+		node_port_set(*node, p, O_READ | O_DIRECTORY);
+		p = MACH_PORT_NULL;
+		}
 
 	/*Construct the full path to the node*/
 	err = lnode_path_construct(lnode, NULL);
@@ -785,6 +860,7 @@ netfs_attempt_lookup
 	
 	/*Now the node is up-to-date*/
 	(*node)->nn->flags = FLAG_NODE_ULFS_UPTODATE;
+	(*node)->nn->generation = lnode_generation(lnode);
 
 	/*Return the result of performing the operations*/
 	finalize();
@@ -971,8 +1047,27 @@ netfs_attempt_set_size
 	{
 	LOG_MSG("netfs_attempt_set_size");
 
-	/*Operation is not supported*/
-	return EOPNOTSUPP;
+	error_t err = 0;
+	
+	/*The size of the root directory cannot be set*/
+	if(NODE_IS_ROOT(node))
+		return EISDIR;
+	
+	/*Write out the buffered data first, so that they would be truncated too*/
+	err = writeback_sync(node);
+	if(err)
+		return err;
+		
+	/*Set the size of the underlying file*/
+	err = node_port_ensure(node, O_WRITE);
+	if(!err)
+		err = file_set_size(node->nn->port, size);
+	
+	/*Whatever was cached about the file is out of date now*/
+	writeback_invalidate(node);
+	
+	/*Return the result*/
+	return err;
 	}/*netfs_attempt_set_size*/
 /*----------------------------------------------------------------------------*/
 /*Fetches the filesystem status information*/
@@ -1000,6 +1095,9 @@ netfs_attempt_syncfs
 	{
 	LOG_MSG("netfs_attempt_syncfs");
 
+	/*Write out the buffered data of all files*/
+	writeback_flush_all();
+
 	/*Everythin OK*/
 	return 0;
 	}/*netfs_attempt_syncfs*/
@@ -1069,39 +1167,305 @@ netfs_attempt_read
 	LOG_MSG("netfs_attempt_read");
 
 	error_t err = 0;
+	
+	/*The data written but not yet forwarded must be read, too*/
+	writeback_flush(np);
 
-	/*If there is no port open for the current node*/
-	if(np->nn->port == MACH_PORT_NULL)
-		{
-		/*the parent node of the current node*/
-		node_t * dnp;
+	/*If the file is small and hot, serve it from the cache of blocks*/
+	if(bcache_read(np, offset, len, data) == 0)
+		return 0;
 
-		/*obtain the parent node of the the current node*/
-		err = ncache_node_lookup(np->nn->lnode->dir, &dnp);
-		
-		/*the lookup should never fail here*/
-		assert(!err);
+	/*If the data have been fetched ahead, serve them from memory*/
+	if(readahead_read(np, offset, len, data) == 0)
+		return 0;
+
+	/*Make sure there is a port open for the current node; it is reopened
+		lazily if the cache of ports has closed it*/
+	err = node_port_ensure(np, O_READ);
+	if(err)
+		return EBADF;
 		
-		/*open a port to the file we are interested in*/
-		mach_port_t p = file_name_lookup_under
-			(dnp->nn->port, np->nn->lnode->name, O_READ, 0);
+	/*The buffer in which the data will arrive and its size*/
+	char * buf = data;
+	mach_msg_type_number_t buf_len = *len;
 
-		/*put `dnp` back, since we don't need it any more*/
-		netfs_nput(dnp);
+	/*Read the required data from the file*/
+	err = io_read(np->nn->port, &buf, &buf_len, offset, *len);
+	
+	/*If the underlying filesystem sent the data out-of-line, copy them into
+		the buffer provided by libnetfs and free the out-of-line memory*/
+	if(!err && (buf != data))
+		{
+		memcpy(data, buf, buf_len);
+		munmap(buf, buf_len);
+		}
+	
+	/*Report how much has been read and fetch the following data in the
+		background, if the file is being read sequentially*/
+	if(!err)
+		{
+		*len = buf_len;
+		readahead_note(np, offset, buf_len);
+		}
 
-		if(!p)
-			return EBADF;
-			
-		/*store the port in the node*/
-		np->nn->port = p;
+	/*Return the result of reading*/
+	return err;
+	}/*netfs_attempt_read*/
+/*----------------------------------------------------------------------------*/
+/*Serves io_read for `user`, forwarding large reads of regular files
+	directly to the underlying file*/
+/*This replaces the implementation in libnetfs, which always goes through
+	netfs_attempt_read with a buffer of its own, so the data sent by the
+	underlying filesystem have to be copied at least once. Here, if the read
+	is large enough, the reply buffer is handed to the underlying filesystem,
+	and whatever it sends out-of-line goes to the client as it is.*/
+kern_return_t
+netfs_S_io_read
+	(
+	struct protid * user,
+	data_t * data,
+	mach_msg_type_number_t * datalen,
+	loff_t offset,
+	vm_size_t amount
+	)
+	{
+	error_t err = 0;
+	
+	/*The node being read*/
+	struct node * np;
+	
+	/*The position to start reading at*/
+	loff_t start;
+	
+	/*Nonzero if a buffer has been allocated here*/
+	int alloced = 0;
+	
+	/*The target of the symlink being read*/
+	char * target;
+
+	/*If the request does not come from one of our users, ignore it*/
+	if(!user)
+		return EOPNOTSUPP;
+
+	/*Lock the node*/
+	np = user->po->np;
+	mutex_lock(&np->lock);
+	
+	/*If the file has not been opened for reading, stop*/
+	if((user->po->openstat & O_READ) == 0)
+		{
+		mutex_unlock(&np->lock);
+		return EBADF;
+		}
+	
+	/*The data written but not yet forwarded must be read, too*/
+	if(!NODE_IS_ROOT(np))
+		writeback_flush(np);
+	
+	/*Compute the starting position*/
+	start = (offset == -1) ? (user->po->filepointer) : (offset);
+	if(start < 0)
+		{
+		mutex_unlock(&np->lock);
+		return EINVAL;
 		}
+	
+	/*If the read is large and goes to a regular file which can be reached
+		(and which is not small enough to be served by the cache of blocks)*/
+	if
+		(
+		(zero_copy_min > 0) && (amount >= zero_copy_min)
+		&& S_ISREG(np->nn_stat.st_mode)
+		&& ((bcache_size == 0) || (np->nn_stat.st_size > BCACHE_FILE_MAX))
+		&& (node_port_ensure(np, O_READ) == 0)
+		)
+		{
+		/*let the underlying filesystem fill the reply buffer or send its own
+			memory, which will be passed on without touching it*/
+		err = io_read(np->nn->port, data, datalen, start, amount);
+		}
+	else
+		{
+		/*If the reply buffer is too small, allocate a bigger one*/
+		if(amount > *datalen)
+			{
+			*data = mmap(0, amount, PROT_READ | PROT_WRITE, MAP_ANON, 0, 0);
+			if(*data == MAP_FAILED)
+				{
+				mutex_unlock(&np->lock);
+				return ENOMEM;
+				}
+			alloced = 1;
+			}
+		*datalen = amount;
 		
-	/*Read the required data from the file*/
-	err = io_read(np->nn->port, (char **)&data, len, offset, *len);
+		/*the contents of a symlink are its target, like in libnetfs*/
+		if(S_ISLNK(np->nn_stat.st_mode))
+			{
+			if(start >= np->nn_stat.st_size)
+				*datalen = 0;
+			else
+				{
+				if(start + *datalen > np->nn_stat.st_size)
+					*datalen = np->nn_stat.st_size - start;
+				target = malloc(np->nn_stat.st_size);
+				err = (target)
+					? (netfs_attempt_readlink(user->user, np, target)) : (ENOMEM);
+				if(!err)
+					memcpy(*data, target + start, *datalen);
+				free(target);
+				}
+			}
+		/*read through the usual path*/
+		else
+			err = netfs_attempt_read(user->user, np, start, datalen, *data);
 
+		/*If the buffer allocated above is not needed (or not all of it)*/
+		if(alloced)
+			{
+			if(err)
+				munmap(*data, amount);
+			else if(round_page(*datalen) < round_page(amount))
+				munmap(*data + round_page(*datalen),
+					round_page(amount) - round_page(*datalen));
+			}
+		}
+	
+	/*If the file pointer is used, advance it*/
+	if(!err && (offset == -1))
+		user->po->filepointer += *datalen;
+		
+	mutex_unlock(&np->lock);
+	
 	/*Return the result of reading*/
 	return err;
-	}/*netfs_attempt_read*/
+	}/*netfs_S_io_read*/
+/*----------------------------------------------------------------------------*/
+/*Serves io_map for `user`, returning the memory objects of the underlying
+	file*/
+/*libnetfs cannot map files at all. Since the files we show are the files of
+	the underlying filesystem, the memory objects of the latter can be given to
+	our clients directly, so that they share the pages with everybody else who
+	maps the same file.*/
+kern_return_t
+netfs_S_io_map
+	(
+	struct protid * user,
+	mach_port_t * rdobj,
+	mach_msg_type_name_t * rdobjtype,
+	mach_port_t * wrobj,
+	mach_msg_type_name_t * wrobjtype
+	)
+	{
+	error_t err = 0;
+	
+	/*The node being mapped*/
+	struct node * np;
+	
+	/*The mode in which the file was opened by the user*/
+	int flags;
+	
+	/*A port to the underlying file opened with the same mode*/
+	file_t port;
+
+	/*If the request does not come from one of our users, ignore it*/
+	if(!user)
+		return EOPNOTSUPP;
+		
+	/*Lock the node*/
+	np = user->po->np;
+	mutex_lock(&np->lock);
+	
+	/*Only regular files can be mapped*/
+	if(!S_ISREG(np->nn_stat.st_mode) || NODE_IS_ROOT(np))
+		{
+		mutex_unlock(&np->lock);
+		return EOPNOTSUPP;
+		}
+	
+	/*The underlying file must be opened in the same mode as ours, so that
+		it hands out exactly the memory objects the user is entitled to*/
+	flags = user->po->openstat & (O_READ | O_WRITE);
+	if(!flags)
+		{
+		mutex_unlock(&np->lock);
+		return EBADF;
+		}
+	
+	/*The memory object must contain the data written but not yet forwarded*/
+	writeback_flush(np);
+	
+	/*Open the underlying file by its name in the parent directory (the port
+		of the node may have been opened in a wider mode)*/
+	err = node_port_open(np, flags, &port);
+	if(err)
+		{
+		mutex_unlock(&np->lock);
+		return err;
+		}
+	
+	mutex_unlock(&np->lock);
+		
+	/*Obtain the memory objects*/
+	err = io_map(port, rdobj, wrobj);
+	
+	/*The memory objects live on without the port*/
+	PORT_DEALLOC(port);
+	
+	/*If the memory objects have been obtained, pass our rights to them to
+		the user*/
+	if(!err)
+		{
+		*rdobjtype = *wrobjtype = MACH_MSG_TYPE_MOVE_SEND;
+		LOG_MSG("netfs_S_io_map: Mapped '%s'.", np->nn->lnode->name);
+		}
+	
+	/*Return the result of mapping*/
+	return err;
+	}/*netfs_S_io_map*/
+/*----------------------------------------------------------------------------*/
+/*Serves dir_notice_changes for `user`, sending the changes of the filtered
+	view of the directory to `notify`*/
+/*libnetfs does not implement this RPC, so the clients watching a directory
+	would have to list it over and over again, running the filter each time.
+	The changes of the underlying directory are filtered one entry at a time
+	instead (see notify.{c,h}).*/
+kern_return_t
+netfs_S_dir_notice_changes
+	(
+	struct protid * user,
+	mach_port_t notify
+	)
+	{
+	error_t err;
+	
+	/*The directory being watched*/
+	struct node * np;
+	
+	/*If the request does not come from one of our users, ignore it*/
+	if(!user)
+		return EOPNOTSUPP;
+		
+	/*Lock the node*/
+	np = user->po->np;
+	mutex_lock(&np->lock);
+	
+	/*Only directories have entries to watch, and only those who may list
+		them may watch them*/
+	if(!S_ISDIR(np->nn_stat.st_mode))
+		err = ENOTDIR;
+	else
+		err = fshelp_access(&np->nn_stat, S_IREAD, user->user);
+		
+	/*Register the client*/
+	if(!err)
+		err = notify_client_add(np, notify);
+		
+	mutex_unlock(&np->lock);
+	
+	/*Return the result of registration*/
+	return err;
+	}/*netfs_S_dir_notice_changes*/
 /*----------------------------------------------------------------------------*/
 /*Writes to file `node` up to `len` bytes from offset from `data`*/
 error_t
@@ -1116,7 +1480,9 @@ netfs_attempt_write
 	{
 	LOG_MSG("netfs_attempt_write");
 
-	return 0;
+	/*Forward the data to the underlying file, through the write-behind
+		buffer if it is enabled*/
+	return writeback_write(node, offset, len, data);
 	}/*netfs_attempt_write*/
 /*----------------------------------------------------------------------------*/
 /*Frees all storage associated with the node*/
@@ -1184,6 +1550,39 @@ main
 	ncache_init(ncache_size);
 	LOG_MSG("Cache initialized.");
 	
+	/*Initialize the cache of ports*/
+	pcache_init(pcache_size);
+	LOG_MSG("Port cache initialized.");
+	
+	/*Initialize the cache of blocks*/
+	bcache_init(bcache_size);
+	LOG_MSG("Block cache initialized.");
+	
+	/*Start writing out the buffered data in the background*/
+	err = writeback_init();
+	if(err)
+		error(EXIT_FAILURE, err, "Failed to start the write-behind thread");
+	
+	/*Start prefetching the verdicts in subdirectories*/
+	err = prefetch_init();
+	if(err)
+		error(EXIT_FAILURE, err, "Failed to start the prefetch thread");
+	
+	/*Start refreshing the listings of hot directories*/
+	err = refresh_init();
+	if(err)
+		error(EXIT_FAILURE, err, "Failed to start the refresh thread");
+	
+	/*Start receiving the changes of the underlying directories*/
+	err = notify_init();
+	if(err)
+		error(EXIT_FAILURE, err, "Failed to start the notification thread");
+	
+	/*Start collecting the results of the filtering commands*/
+	err = filter_init();
+	if(err)
+		error(EXIT_FAILURE, err, "Failed to start the filter executor");
+	
 	/*Obtain stat information about the underlying node*/
 	err = io_stat(underlying_node, &underlying_node_stat);
 	if(err)
@@ -47,6 +47,10 @@
 /*The inode for the root node*/
 #define FILTERFS_ROOT_INODE 1
 /*----------------------------------------------------------------------------*/
+/*The default size of reads starting with which the data returned by the
+	underlying filesystem are handed to the client without copying*/
+#define FILTERFS_ZERO_COPY_MIN (16 * 4096)
+/*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Global Variables----------------------------------------------------*/
@@ -60,6 +64,10 @@ extern mach_port_t underlying_node;
 /*The stat information about the underlying node*/
 extern io_statbuf_t underlying_node_stat;
 /*----------------------------------------------------------------------------*/
+/*The size of reads starting with which the data are forwarded without
+	copying (0 disables forwarding)*/
+extern size_t zero_copy_min;
+/*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Structures----------------------------------------------------------*/
@@ -432,6 +440,39 @@ netfs_attempt_read
 	void * data
 	);
 /*----------------------------------------------------------------------------*/
+/*Serves io_read for `user`, forwarding large reads of regular files
+	directly to the underlying file*/
+kern_return_t
+netfs_S_io_read
+	(
+	struct protid * user,
+	data_t * data,
+	mach_msg_type_number_t * datalen,
+	loff_t offset,
+	vm_size_t amount
+	);
+/*----------------------------------------------------------------------------*/
+/*Serves io_map for `user`, returning the memory objects of the underlying
+	file*/
+kern_return_t
+netfs_S_io_map
+	(
+	struct protid * user,
+	mach_port_t * rdobj,
+	mach_msg_type_name_t * rdobjtype,
+	mach_port_t * wrobj,
+	mach_msg_type_name_t * wrobjtype
+	);
+/*----------------------------------------------------------------------------*/
+/*Serves dir_notice_changes for `user`, sending the changes of the filtered
+	view of the directory to `notify`*/
+kern_return_t
+netfs_S_dir_notice_changes
+	(
+	struct protid * user,
+	mach_port_t notify
+	);
+/*----------------------------------------------------------------------------*/
 /*Writes to file `node` up to `len` bytes from offset from `data`*/
 error_t
 netfs_attempt_write
@@ -51,6 +51,11 @@
 /*Deallocate the given port for the current task*/
 #define PORT_DEALLOC(p) (mach_port_deallocate(mach_task_self(), (p)))
 /*----------------------------------------------------------------------------*/
+/*Nonzero if the times `a` and `b` (struct timespec) are the same; files are
+	compared by nanoseconds, since they can change many times a second*/
+#define TIMESPEC_EQUAL(a, b)\
+	(((a).tv_sec == (b).tv_sec) && ((a).tv_nsec == (b).tv_nsec))
+/*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Functions-----------------------------------------------------------*/
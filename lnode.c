@@ -27,8 +27,30 @@
 /*----------------------------------------------------------------------------*/
 #define _GNU_SOURCE
 /*----------------------------------------------------------------------------*/
+#include <maptime.h>
+/*----------------------------------------------------------------------------*/
 #include "lnode.h"
+#include "lib.h"
 #include "debug.h"
+#include "filterfs.h"
+#include "filter.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The time during which cached attributes are valid (may be overwritten by
+	the user)*/
+int lnode_attr_timeout = LNODE_ATTR_TIMEOUT;
+/*----------------------------------------------------------------------------*/
+/*The generation of the whole cache*/
+unsigned long lnode_cache_generation;
+/*----------------------------------------------------------------------------*/
+/*The lock protecting the reference counts of all lnodes and the links
+	between them; no other lock is acquired while it is held*/
+static struct mutex lnode_refs_lock = MUTEX_INITIALIZER;
+/*----------------------------------------------------------------------------*/
+/*The identity of the last lnode created (protected by lnode_refs_lock)*/
+static unsigned long lnode_last_id;
 /*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
@@ -41,31 +63,70 @@ lnode_ref_add
 	)
 	{
 	/*Increment the number of references*/
+	mutex_lock(&lnode_refs_lock);
 	++node->references;
+	mutex_unlock(&lnode_refs_lock);
 	}/*lnode_ref_add*/
 /*----------------------------------------------------------------------------*/
-/*Removes a reference from `node` (which must be locked). If that was the last
-	reference, destroy the node*/
+/*Removes a reference from `node` (which must be locked) and unlocks it. If
+	that was the last reference, destroy the node*/
 void
 lnode_ref_remove
 	(
 	lnode_t * node
 	)
 	{
+	/*The lnode (directory) which loses an entry*/
+	lnode_t * dir;
+	
+	mutex_lock(&lnode_refs_lock);
+	
 	/*Fail if the node is not referenced by anybody*/
 	assert(node->references);
 	
 	/*Decrement the number of references to `node`*/
 	--node->references;
 	
-	/*If there are no references remaining*/
-	if(node->references == 0)
+	/*If somebody still uses the node, just unlock it*/
+	if(node->references)
 		{
-		/*TODO: destroy the lnode*/
-		}
-	else
-		/*simply unlock the node*/
+		mutex_unlock(&lnode_refs_lock);
 		mutex_unlock(&node->lock);
+		return;
+		}
+	
+	/*Nobody can reach the node any more: the lock may be released before
+		it is destroyed*/
+	mutex_unlock(&node->lock);
+	
+	/*Remove the unused lnodes from the tree; each of them held a reference
+		to its directory, which may become unused in its turn (an unused lnode
+		is not locked by anybody, so the lock on it is not needed)*/
+	for(; node; node = dir)
+		{
+		/*unlink the node from the list of entries of its directory*/
+		dir = node->dir;
+		if(dir)
+			{
+			*node->prevp = node->next;
+			if(node->next)
+				node->next->prevp = node->prevp;
+			}
+		
+		/*the entries hold references to the directory, so there are none*/
+		assert(!node->entries);
+		
+		/*destroy the node*/
+		mutex_unlock(&lnode_refs_lock);
+		lnode_destroy(node);
+		mutex_lock(&lnode_refs_lock);
+		
+		/*drop the reference the node held on its directory*/
+		if(dir && (--dir->references != 0))
+			break;
+		}
+	
+	mutex_unlock(&lnode_refs_lock);
 	}/*lnode_ref_remove*/
 /*----------------------------------------------------------------------------*/
 /*Creates a new lnode with `name`; the new node is locked and contains
@@ -112,11 +173,15 @@ lnode_create
 	node_new->name 				= name_cp;
 	node_new->name_len		= (name_cp) ? (strlen(name_cp)) : (0);
 	
-	/*Setup one reference to this lnode*/
+	/*Setup one reference to this lnode and give it its identity*/
 	node_new->references = 1;
+	mutex_lock(&lnode_refs_lock);
+	node_new->id = ++lnode_last_id;
+	mutex_unlock(&lnode_refs_lock);
 	
-	/*Initialize the mutex and acquire a lock on this lnode*/
+	/*Initialize the mutexes and acquire a lock on this lnode*/
 	mutex_init(&node_new->lock);
+	mutex_init(&node_new->cache_lock);
 	mutex_lock(&node_new->lock);
 	
 	/*Store the result in the second parameter*/
@@ -133,8 +198,13 @@ lnode_destroy
 	lnode_t * node	/*destroy this*/
 	)
 	{
-	/*Destroy the name of the node*/
+	/*Destroy the name of the node and the path to it*/
 	free(node->name);
+	free(node->path);
+	
+	/*Release the underlying directory*/
+	if(node->dir_port != MACH_PORT_NULL)
+		PORT_DEALLOC(node->dir_port);
 	
 	/*Destroy the node itself*/
 	free(node);
@@ -234,8 +304,13 @@ lnode_get
 	/*The pointer to the required lnode*/
 	lnode_t * n;
 	
-	/*Find `name` among the names of entries in `dir`*/
+	/*Find `name` among the names of entries in `dir` and increment the
+		refcount of the found lnode, so that it stays alive until it is locked*/
+	mutex_lock(&lnode_refs_lock);
 	for(n = dir->entries; n && (strcmp(n->name, name) != 0); n = n->next);
+	if(n)
+		++n->references;
+	mutex_unlock(&lnode_refs_lock);
 	
 	/*If the search has been successful*/
 	if(n)
@@ -243,9 +318,6 @@ lnode_get
 		/*lock the node*/
 		mutex_lock(&n->lock);
 		
-		/*increment the refcount of the found lnode*/
-		lnode_ref_add(n);
-		
 		/*put a pointer to `n` into the parameter*/
 		*node = n;
 		}
@@ -265,6 +337,8 @@ lnode_install
 	lnode_t * node	/*install this*/
 	)
 	{
+	mutex_lock(&lnode_refs_lock);
+	
 	/*Install `node` into the list of entries in `dir`*/
 	node->next = dir->entries;
 	node->prevp = &dir->entries; /*this node is the first on the list*/
@@ -274,9 +348,306 @@ lnode_install
 	dir->entries = node;
 	
 	/*Add a new reference to dir*/
-	lnode_ref_add(dir);
+	++dir->references;
 	
 	/*Setup the `dir` link in node*/
 	node->dir = dir;
+	
+	mutex_unlock(&lnode_refs_lock);
 	}/*lnode_install*/
 /*----------------------------------------------------------------------------*/
+/*Stores `stat` as the cached attributes of `node`*/
+void
+lnode_stat_store
+	(
+	lnode_t * node,
+	io_statbuf_t * stat
+	)
+	{
+	/*The current time and generation of the cache*/
+	struct timeval tv;
+	unsigned long generation = lnode_generation(node);
+	maptime_read(maptime, &tv);
+	
+	mutex_lock(&node->cache_lock);
+	
+	/*Store the attributes and remember when they were obtained*/
+	node->stat = *stat;
+	node->stat_timestamp = tv.tv_sec;
+	node->stat_generation = generation;
+	node->flags |= FLAG_LNODE_STAT_VALID;
+	
+	mutex_unlock(&node->cache_lock);
+	}/*lnode_stat_store*/
+/*----------------------------------------------------------------------------*/
+/*Copies the cached attributes of `node` into `stat`, if they are still
+	valid; returns ESTALE otherwise*/
+error_t
+lnode_stat_fetch
+	(
+	lnode_t * node,
+	io_statbuf_t * stat
+	)
+	{
+	error_t err = ESTALE;
+	
+	/*The current time and generation of the cache*/
+	struct timeval tv;
+	unsigned long generation;
+
+	/*If the cache is disabled, there is nothing to fetch*/
+	if(lnode_attr_timeout <= 0)
+		return err;
+	
+	maptime_read(maptime, &tv);
+	generation = lnode_generation(node);
+
+	mutex_lock(&node->cache_lock);
+	
+	/*If the attributes are present, have not expired and have not been
+		invalidated, copy them*/
+	if
+		(
+		(node->flags & FLAG_LNODE_STAT_VALID)
+		&& (tv.tv_sec - node->stat_timestamp < lnode_attr_timeout)
+		&& (node->stat_generation == generation)
+		)
+		{
+		*stat = node->stat;
+		err = 0;
+		}
+	
+	mutex_unlock(&node->cache_lock);
+
+	/*Return the result of the lookup*/
+	return err;
+	}/*lnode_stat_fetch*/
+/*----------------------------------------------------------------------------*/
+/*Drops the cached attributes of `node`*/
+void
+lnode_stat_invalidate
+	(
+	lnode_t * node
+	)
+	{
+	mutex_lock(&node->cache_lock);
+	node->flags &= ~FLAG_LNODE_STAT_VALID;
+	mutex_unlock(&node->cache_lock);
+	}/*lnode_stat_invalidate*/
+/*----------------------------------------------------------------------------*/
+/*Records whether `node` satisfies the property, as found while its
+	directory had the modification time `dir_mtime` and the property had the
+	epoch `epoch`*/
+void
+lnode_verdict_store
+	(
+	lnode_t * node,
+	int good,
+	struct timespec dir_mtime,
+	unsigned long epoch
+	)
+	{
+	mutex_lock(&node->cache_lock);
+	
+	/*Store the verdict together with its validity token*/
+	node->verdict_dir_mtime = dir_mtime;
+	node->verdict_epoch = epoch;
+	node->flags |= FLAG_LNODE_VERDICT;
+	if(good)
+		node->flags |= FLAG_LNODE_GOOD;
+	else
+		node->flags &= ~FLAG_LNODE_GOOD;
+	
+	mutex_unlock(&node->cache_lock);
+	}/*lnode_verdict_store*/
+/*----------------------------------------------------------------------------*/
+/*Returns the verdict recorded for `node` (LNODE_VERDICT_GOOD or _BAD), if
+	the directory still has the modification time `dir_mtime` and the
+	property still has the epoch `epoch`; returns LNODE_VERDICT_UNKNOWN
+	otherwise*/
+int
+lnode_verdict_fetch
+	(
+	lnode_t * node,
+	struct timespec dir_mtime,
+	unsigned long epoch
+	)
+	{
+	int verdict = LNODE_VERDICT_UNKNOWN;
+	
+	mutex_lock(&node->cache_lock);
+	
+	/*If the verdict has been obtained in the same state of the directory and
+		under the same property, it still holds*/
+	if
+		(
+		(node->flags & FLAG_LNODE_VERDICT)
+		&& TIMESPEC_EQUAL(node->verdict_dir_mtime, dir_mtime)
+		&& (node->verdict_epoch == epoch)
+		)
+		verdict = (node->flags & FLAG_LNODE_GOOD)
+			? (LNODE_VERDICT_GOOD) : (LNODE_VERDICT_BAD);
+	
+	mutex_unlock(&node->cache_lock);
+
+	return verdict;
+	}/*lnode_verdict_fetch*/
+/*----------------------------------------------------------------------------*/
+/*Drops the verdict recorded for `node`; returns it if it was obtained under
+	the epoch `epoch` of the property, whatever the state of the directory
+	was (LNODE_VERDICT_UNKNOWN otherwise)*/
+int
+lnode_verdict_invalidate
+	(
+	lnode_t * node,
+	unsigned long epoch
+	)
+	{
+	int verdict = LNODE_VERDICT_UNKNOWN;
+	
+	mutex_lock(&node->cache_lock);
+	
+	if((node->flags & FLAG_LNODE_VERDICT) && (node->verdict_epoch == epoch))
+		verdict = (node->flags & FLAG_LNODE_GOOD)
+			? (LNODE_VERDICT_GOOD) : (LNODE_VERDICT_BAD);
+	node->flags &= ~FLAG_LNODE_VERDICT;
+	
+	mutex_unlock(&node->cache_lock);
+	
+	return verdict;
+	}/*lnode_verdict_invalidate*/
+/*----------------------------------------------------------------------------*/
+/*Returns the generation of the cache `node` is in: the sum of the generation
+	of the whole cache and of the generations of `node` and its directories
+	(to which `node` holds references)*/
+unsigned long
+lnode_generation
+	(
+	lnode_t * node
+	)
+	{
+	unsigned long generation = lnode_cache_generation;
+	
+	/*The generations are only read, a bump racing with the walk is seen by
+		the next one*/
+	for(; node; node = node->dir)
+		generation += node->generation;
+		
+	return generation;
+	}/*lnode_generation*/
+/*----------------------------------------------------------------------------*/
+/*Returns the epoch verdicts on the entries of the directory `node` are
+	obtained in: the epoch of the property plus the generation of the cache
+	the directory is in*/
+unsigned long
+lnode_epoch
+	(
+	lnode_t * node
+	)
+	{
+	return property_epoch + lnode_generation(node);
+	}/*lnode_epoch*/
+/*----------------------------------------------------------------------------*/
+/*Makes everything cached about `node` and the entries below it stale*/
+void
+lnode_invalidate
+	(
+	lnode_t * node
+	)
+	{
+	mutex_lock(&node->cache_lock);
+	++node->generation;
+	mutex_unlock(&node->cache_lock);
+	}/*lnode_invalidate*/
+/*----------------------------------------------------------------------------*/
+/*Makes everything cached stale*/
+void
+lnode_invalidate_all(void)
+	{
+	++lnode_cache_generation;
+	}/*lnode_invalidate_all*/
+/*----------------------------------------------------------------------------*/
+/*Returns the rule applying to the entries of the directory `node`: the rule
+	of the nearest directory above it, `node` included, for which a rule has
+	been given, or FILTER_RULE_DEFAULT; if the verdicts on directories are
+	inherited, the entries of a directory without a rule of its own are all
+	accepted, unless it is the root. The result is cached in the lnodes until
+	the property or the rules change, so the rules are matched once per
+	directory*/
+error_t
+lnode_rule
+	(
+	lnode_t * node,
+	int * rule	/*store the rule here*/
+	)
+	{
+	error_t err;
+	
+	/*The epoch of the property the rule is resolved in*/
+	unsigned long epoch = property_epoch;
+	
+	/*The path of the directory relative to the root of the filesystem, its
+		length and the current lnode on the way to the root*/
+	char * path;
+	size_t len = 0;
+	lnode_t * n;
+	
+	/*If the rule has been resolved under the same rules, it still holds*/
+	*rule = FILTER_RULE_NONE;
+	mutex_lock(&node->cache_lock);
+	if((node->flags & FLAG_LNODE_RULE) && (node->rule_epoch == epoch))
+		*rule = node->rule;
+	mutex_unlock(&node->cache_lock);
+	if(*rule != FILTER_RULE_NONE)
+		return 0;
+		
+	/*Build the relative path from the names of the lnodes on the way to the
+		root (unlike `path`, which is replaced when the node is updated, the
+		names and the links to the directories never change, so no lock is
+		required)*/
+	for(n = node; n->dir; n = n->dir)
+		len += n->name_len + 1;
+	path = malloc(len + 1);
+	if(!path)
+		return ENOMEM;
+	path[len] = 0;
+	for(n = node; n->dir; n = n->dir)
+		{
+		len -= n->name_len;
+		memcpy(path + len, n->name, n->name_len);
+		if(n->dir->dir)
+			path[--len] = '/';
+		}
+	
+	/*Look for a rule given for this very directory*/
+	*rule = filter_rule_find(path + len);
+	free(path);
+		
+	/*Otherwise, a directory below the root has been accepted by the filter
+		(filterfs never shows rejected ones), so with inherited verdicts its
+		entries are accepted as well; without them, the directory takes the
+		rule of its parent*/
+	if(*rule == FILTER_RULE_NONE)
+		{
+		if(!node->dir)
+			*rule = FILTER_RULE_DEFAULT;
+		else if(filter_prune)
+			*rule = FILTER_RULE_ACCEPT;
+		else
+			{
+			err = lnode_rule(node->dir, rule);
+			if(err)
+				return err;
+			}
+		}
+		
+	/*Remember the rule*/
+	mutex_lock(&node->cache_lock);
+	node->rule = *rule;
+	node->rule_epoch = epoch;
+	node->flags |= FLAG_LNODE_RULE;
+	mutex_unlock(&node->cache_lock);
+	
+	return 0;
+	}/*lnode_rule*/
+/*----------------------------------------------------------------------------*/
@@ -31,6 +31,27 @@
 #include <hurd/netfs.h>
 /*----------------------------------------------------------------------------*/
 
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*The default time (in seconds) during which cached attributes are
+	considered valid*/
+#define LNODE_ATTR_TIMEOUT 3
+/*----------------------------------------------------------------------------*/
+/*Lnode flags*/
+#define FLAG_LNODE_STAT_VALID	0x00000001	/*the cached attributes are valid*/
+#define FLAG_LNODE_VERDICT		0x00000002	/*the verdict is recorded*/
+#define FLAG_LNODE_GOOD				0x00000004	/*the entry satisfies the
+																						property*/
+#define FLAG_LNODE_WATCHED		0x00000008	/*the changes of the directory
+																						are notified*/
+#define FLAG_LNODE_RULE				0x00000010	/*the rule is resolved*/
+/*----------------------------------------------------------------------------*/
+/*The possible results of looking up a recorded verdict*/
+#define LNODE_VERDICT_UNKNOWN	(-1)
+#define LNODE_VERDICT_BAD			0
+#define LNODE_VERDICT_GOOD		1
+/*----------------------------------------------------------------------------*/
+
 /*----------------------------------------------------------------------------*/
 /*A candy synonym for the fundamental libnetfs node*/
 typedef struct node node_t;
@@ -48,6 +69,10 @@ struct lnode
 	/*the full path to the lnode*/
 	char * path;
 	
+	/*the identity of the lnode, never reused (unlike its address) while the
+		translator runs*/
+	unsigned long id;
+	
 	/*the associated flags*/
 	int flags;
 	
@@ -63,16 +88,61 @@ struct lnode
 	/*the lnode (directory) in which this node is contained*/
 	struct lnode * dir;
 	
+	/*a send right to the underlying directory in which the file is looked
+		up by `name`; it is set (under `lock`) by the first lookup of the
+		file, before the lnode gets a node, and kept while the lnode lives,
+		so reopening the file never needs the node of the directory*/
+	mach_port_t dir_port;
+	
 	/*the beginning of the list of entries contained in this lnode (directory)*/
 	struct lnode * entries;
 	
+	/*the cached attributes of the underlying file and the moment when they
+		were obtained, together with the generation of the cache (see
+		lnode_generation) they were obtained in (valid if FLAG_LNODE_STAT_VALID
+		is set)*/
+	io_statbuf_t stat;
+	time_t stat_timestamp;
+	unsigned long stat_generation;
+	
+	/*the validity token of the recorded verdict (valid if FLAG_LNODE_VERDICT
+		is set): the modification time of the directory and the epoch of the
+		property at the moment the verdict was obtained*/
+	struct timespec verdict_dir_mtime;
+	unsigned long verdict_epoch;
+	
+	/*the generation of the subtree rooted in this lnode: bumping it makes
+		everything cached about the lnode and the entries below it stale at
+		once, which is discovered when the cached information is next used*/
+	unsigned long generation;
+	
+	/*the rule applying to the entries of this directory (see filter.h) and
+		the epoch of the property it was resolved in (valid if
+		FLAG_LNODE_RULE is set)*/
+	int rule;
+	unsigned long rule_epoch;
+	
 	/*a lock*/
 	struct mutex lock;
+	
+	/*a lock protecting the cached information about the underlying file (it
+		is never held for longer than copying the information)*/
+	struct mutex cache_lock;
 	};/*struct lnode*/
 /*----------------------------------------------------------------------------*/
 typedef struct lnode lnode_t;
 /*----------------------------------------------------------------------------*/
 
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The time during which cached attributes are valid (0 disables the cache)*/
+extern int lnode_attr_timeout;
+/*----------------------------------------------------------------------------*/
+/*The generation of the whole cache: bumping it makes everything cached
+	stale at once*/
+extern unsigned long lnode_cache_generation;
+/*----------------------------------------------------------------------------*/
+
 /*----------------------------------------------------------------------------*/
 /*--------Functions-----------------------------------------------------------*/
 /*Adds a reference to the `lnode` (which must be locked)*/
@@ -82,8 +152,8 @@ lnode_ref_add
 	lnode_t * node
 	);
 /*----------------------------------------------------------------------------*/
-/*Removes a reference from `node` (which must be locked). If that was the last
-	reference, destroy the node*/
+/*Removes a reference from `node` (which must be locked) and unlocks it. If
+	that was the last reference, destroy the node*/
 void
 lnode_ref_remove
 	(
@@ -133,4 +203,107 @@ lnode_install
 	lnode_t * node	/*install this*/
 	);
 /*----------------------------------------------------------------------------*/
+/*Stores `stat` as the cached attributes of `node`*/
+void
+lnode_stat_store
+	(
+	lnode_t * node,
+	io_statbuf_t * stat
+	);
+/*----------------------------------------------------------------------------*/
+/*Copies the cached attributes of `node` into `stat`, if they are still
+	valid; returns ESTALE otherwise*/
+error_t
+lnode_stat_fetch
+	(
+	lnode_t * node,
+	io_statbuf_t * stat
+	);
+/*----------------------------------------------------------------------------*/
+/*Drops the cached attributes of `node`*/
+void
+lnode_stat_invalidate
+	(
+	lnode_t * node
+	);
+/*----------------------------------------------------------------------------*/
+/*Records whether `node` satisfies the property, as found while its
+	directory had the modification time `dir_mtime` and the property had the
+	epoch `epoch`*/
+void
+lnode_verdict_store
+	(
+	lnode_t * node,
+	int good,
+	struct timespec dir_mtime,
+	unsigned long epoch
+	);
+/*----------------------------------------------------------------------------*/
+/*Returns the verdict recorded for `node` (LNODE_VERDICT_GOOD or _BAD), if
+	the directory still has the modification time `dir_mtime` and the
+	property still has the epoch `epoch`; returns LNODE_VERDICT_UNKNOWN
+	otherwise*/
+int
+lnode_verdict_fetch
+	(
+	lnode_t * node,
+	struct timespec dir_mtime,
+	unsigned long epoch
+	);
+/*----------------------------------------------------------------------------*/
+/*Drops the verdict recorded for `node`; returns it if it was obtained under
+	the epoch `epoch` of the property, whatever the state of the directory
+	was (LNODE_VERDICT_UNKNOWN otherwise)*/
+int
+lnode_verdict_invalidate
+	(
+	lnode_t * node,
+	unsigned long epoch
+	);
+/*----------------------------------------------------------------------------*/
+/*Returns the generation of the cache `node` is in: the sum of the generation
+	of the whole cache and of the generations of `node` and its directories
+	(to which `node` holds references). As the generations only grow, the sum
+	changes as soon as any of them is bumped, so a token containing it tells
+	whether the information cached about `node` is still good*/
+unsigned long
+lnode_generation
+	(
+	lnode_t * node
+	);
+/*----------------------------------------------------------------------------*/
+/*Returns the epoch verdicts on the entries of the directory `node` are
+	obtained in: the epoch of the property plus the generation of the cache
+	the directory is in*/
+unsigned long
+lnode_epoch
+	(
+	lnode_t * node
+	);
+/*----------------------------------------------------------------------------*/
+/*Makes everything cached about `node` and the entries below it stale*/
+void
+lnode_invalidate
+	(
+	lnode_t * node
+	);
+/*----------------------------------------------------------------------------*/
+/*Makes everything cached stale*/
+void
+lnode_invalidate_all(void);
+/*----------------------------------------------------------------------------*/
+/*Finds the rule applying to the entries of the directory `node`: the rule
+	of the nearest directory above it, `node` included, for which a rule has
+	been given, or FILTER_RULE_DEFAULT; if the verdicts on directories are
+	inherited, the entries of a directory without a rule of its own are all
+	accepted, unless it is the root. The result is cached in the lnodes until
+	the property or the rules change, so the rules are matched once per
+	directory*/
+error_t
+lnode_rule
+	(
+	lnode_t * node,
+	int * rule	/*store the rule here*/
+	);
+/*----------------------------------------------------------------------------*/
 #endif /*__LNODE_H__*/
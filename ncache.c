@@ -28,6 +28,7 @@
 #define _GNU_SOURCE 1
 /*----------------------------------------------------------------------------*/
 #include "ncache.h"
+#include "debug.h"
 /*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
@@ -38,9 +39,96 @@ ncache_t ncache;
 /*Cache size (may be overwritten by the user)*/
 int ncache_size = NCACHE_SIZE;
 /*----------------------------------------------------------------------------*/
+/*The replacement policy (may be overwritten by the user)*/
+int ncache_policy = NCACHE_POLICY;
+/*----------------------------------------------------------------------------*/
+/*The byte budget (may be overwritten by the user)*/
+size_t ncache_bytes = NCACHE_BYTES;
+/*----------------------------------------------------------------------------*/
+/*The memory watermark (may be overwritten by the user)*/
+size_t ncache_watermark = 0;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*Selects the shard responsible for the given lnode (the low bits of the
+	address are always zero because of malloc alignment, so skip them)*/
+#define NCACHE_SHARD(lnode)\
+	(&ncache.shards[(((unsigned long)(lnode)) >> 4) % NCACHE_SHARDS])
+/*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Functions-----------------------------------------------------------*/
+/*Computes the limits of shard number `i` from the limits of the whole cache
+	(both must be locked, unless the cache is being initialized)*/
+static
+void
+ncache_shard_limits_set
+	(
+	int i
+	)
+	{
+	ncache_shard_t * shard = &ncache.shards[i];
+	
+	/*Give each shard an equal part of the total; the remainder goes to the
+		first shards, so that the sum is exactly `size_max`, unless it is smaller
+		than the number of shards: every shard of an enabled cache holds at least
+		one node, or the nodes falling into the empty shards would never be
+		cached*/
+	shard->size_max = (ncache.size_max > 0)
+		? (ncache.size_max / NCACHE_SHARDS
+			+ ((i < ncache.size_max % NCACHE_SHARDS) ? 1 : 0))
+		: (0);
+	if((ncache.size_max > 0) && (shard->size_max == 0))
+		shard->size_max = 1;
+
+	/*Split the byte budget likewise (a shard never gets a zero budget, since
+		that would mean no budget at all)*/
+	shard->bytes_max = (ncache.bytes_effective > 0)
+		? (ncache.bytes_effective / NCACHE_SHARDS + 1)
+		: (0);
+
+	/*the FIFO of new nodes takes a quarter of the shard, the ghosts
+		remember half as many nodes as the shard holds (the values suggested
+		by the authors of 2Q)*/
+	shard->in_size_max = (shard->size_max + 3) / 4;
+	}/*ncache_shard_limits_set*/
+/*----------------------------------------------------------------------------*/
+/*(Re)creates an empty ring of ghosts for `shard` (which must be locked,
+	unless the cache is being initialized), sized according to the current
+	limits of the shard*/
+static
+void
+ncache_shard_ghosts_reset
+	(
+	ncache_shard_t * shard
+	)
+	{
+	/*Forget the old ghosts*/
+	if(shard->ghosts)
+		{
+		hurd_ihash_destroy(&shard->ghosts_index);
+		free(shard->ghosts);
+		}
+	shard->ghosts = NULL;
+	shard->ghosts_first = shard->ghosts_count = 0;
+	hurd_ihash_init(&shard->ghosts_index, HURD_IHASH_NO_LOCP);
+	
+	/*Only 2Q needs ghosts*/
+	shard->ghosts_max = (ncache.policy == NCACHE_POLICY_2Q)
+		? ((shard->size_max + 1) / 2) : (0);
+		
+	/*Allocate the ring*/
+	if(shard->ghosts_max > 0)
+		{
+		shard->ghosts = calloc(shard->ghosts_max, sizeof(unsigned long));
+		
+		/*without ghosts 2Q still works, only without promotions*/
+		if(!shard->ghosts)
+			shard->ghosts_max = 0;
+		}
+	}/*ncache_shard_ghosts_reset*/
+/*----------------------------------------------------------------------------*/
 /*Initializes the node cache*/
 void
 ncache_init
@@ -48,17 +136,42 @@ ncache_init
 	int size_max
 	)
 	{
-	/*Reset the LRU and MRU ends of the list*/
-	ncache.mru = ncache.lru = NULL;
+	int i;
 	
-	/*Set the maximal size according to the parameter*/
+	/*Set the maximal size according to the parameter and the byte budget
+		according to the options*/
 	ncache.size_max = size_max;
+	ncache.bytes_max = ncache.bytes_effective = ncache_bytes;
+	ncache.watermark = ncache_watermark;
 	
-	/*The cache is empty so far; remark that*/
-	ncache.size_current = 0;
-	
-	/*Init the lock*/
+	/*Remember the replacement policy*/
+	ncache.policy = ncache_policy;
 	mutex_init(&ncache.lock);
+
+	/*Go through all shards*/
+	for(i = 0; i < NCACHE_SHARDS; ++i)
+		{
+		ncache_shard_t * shard = &ncache.shards[i];
+
+		/*compute the limits of the shard*/
+		ncache_shard_limits_set(i);
+
+		/*reset the LRU and MRU ends of the chains*/
+		shard->main.mru = shard->main.lru = NULL;
+		shard->in.mru = shard->in.lru = NULL;
+		
+		/*the shard is empty so far; remark that*/
+		shard->main.size_current = shard->in.size_current = 0;
+		shard->bytes_current = 0;
+		shard->pressure_count = 0;
+		
+		/*there are no ghosts yet*/
+		shard->ghosts = NULL;
+		ncache_shard_ghosts_reset(shard);
+		
+		/*init the lock*/
+		mutex_init(&shard->lock);
+		}
 	}/*ncache_init*/
 /*----------------------------------------------------------------------------*/
 /*Looks up the lnode and stores the result in `node`; creates a new entry
@@ -101,11 +214,25 @@ ncache_node_lookup
 	return err;
 	}/*ncache_node_lookup*/
 /*----------------------------------------------------------------------------*/
-/*Removes the given node from the cache*/
+/*Returns the chain of `shard` in which `node` is located*/
+static
+ncache_chain_t *
+ncache_node_chain
+	(
+	ncache_shard_t * shard,
+	node_t * node
+	)
+	{
+	return (node->nn->ncache_list == NCACHE_LIST_IN)
+		? (&shard->in) : (&shard->main);
+	}/*ncache_node_chain*/
+/*----------------------------------------------------------------------------*/
+/*Removes the given node from the cache shard `shard` (which must be locked)*/
 static
 void
 ncache_node_remove
 	(
+	ncache_shard_t * shard,
 	node_t * node
 	)
 	{
@@ -113,6 +240,9 @@ ncache_node_remove
 		specific of us)*/
 	struct netnode * nn = node->nn;
 	
+	/*Obtain the chain containing the node*/
+	ncache_chain_t * chain = ncache_node_chain(shard, node);
+	
 	/*If there exists a successor of this node in the cache chain*/
 	if(nn->ncache_next)
 		/*remove the reference in the successor*/
@@ -123,21 +253,289 @@ ncache_node_remove
 		nn->ncache_prev->nn->ncache_next = nn->ncache_next;
 	
 	/*If the node was located at the MRU end of the list*/
-	if(ncache.mru == node)
+	if(chain->mru == node)
 		/*shift the MRU end to the next node*/
-		ncache.mru = nn->ncache_next;
+		chain->mru = nn->ncache_next;
 	/*If the node was located at the LRU end of the list*/
-	if(ncache.lru == node)
+	if(chain->lru == node)
 		/*shift the LRU end to the previous node*/
-		ncache.lru = nn->ncache_prev;
+		chain->lru = nn->ncache_prev;
 		
 	/*Invalidate the references inside the node*/
 	nn->ncache_next = nn->ncache_prev = NULL;
+	nn->ncache_list = NCACHE_LIST_NONE;
 	
 	/*Count the removal of a node*/
-	--ncache.size_current;
+	--chain->size_current;
+	shard->bytes_current -= nn->ncache_cost;
+	nn->ncache_cost = 0;
 	}/*ncache_node_remove*/
 /*----------------------------------------------------------------------------*/
+/*Puts `node` at the MRU end of the chain `list` of `shard` (which must be
+	locked)*/
+static
+void
+ncache_node_push
+	(
+	ncache_shard_t * shard,
+	node_t * node,
+	int list	/*NCACHE_LIST_MAIN or NCACHE_LIST_IN*/
+	)
+	{
+	/*Obtain the chain to insert into*/
+	ncache_chain_t * chain = (list == NCACHE_LIST_IN)
+		? (&shard->in) : (&shard->main);
+
+	/*put the node at the MRU end of the cache chain*/
+	node->nn->ncache_next = chain->mru;
+	node->nn->ncache_prev = NULL;
+	node->nn->ncache_list = list;
+
+	/*setup the pointer in the old MRU end, if it exists*/
+	if(chain->mru != NULL)
+		chain->mru->nn->ncache_prev = node;
+	
+	/*setup the LRU end of the cache chain, if it did not exist previously*/
+	if(chain->lru == NULL)
+		chain->lru = node;
+	
+	/*shift the MRU end to the new node*/
+	chain->mru = node;
+
+	/*count the addition*/
+	++chain->size_current;
+	}/*ncache_node_push*/
+/*----------------------------------------------------------------------------*/
+/*Remembers `lnode` among the ghosts of `shard` (which must be locked)*/
+static
+void
+ncache_ghost_add
+	(
+	ncache_shard_t * shard,
+	lnode_t * lnode
+	)
+	{
+	/*If there is no room for ghosts at all, do nothing*/
+	if(shard->ghosts_max == 0)
+		return;
+
+	/*If the ring is full, forget the oldest ghost*/
+	if(shard->ghosts_count == shard->ghosts_max)
+		{
+		/*the oldest ghost may have been promoted already*/
+		if(shard->ghosts[shard->ghosts_first])
+			hurd_ihash_remove
+				(&shard->ghosts_index,
+				(hurd_ihash_key_t)shard->ghosts[shard->ghosts_first]);
+				
+		shard->ghosts_first = (shard->ghosts_first + 1) % shard->ghosts_max;
+		--shard->ghosts_count;
+		}
+	
+	/*Compute the position of the new ghost*/
+	int slot = (shard->ghosts_first + shard->ghosts_count) % shard->ghosts_max;
+	
+	/*Register the ghost in the index; if this fails the ghost is merely lost*/
+	if
+		(
+		hurd_ihash_add
+			(&shard->ghosts_index, (hurd_ihash_key_t)lnode->id,
+			(hurd_ihash_value_t)(long)(slot + 1))
+		)
+		return;
+
+	/*Store the ghost in the ring*/
+	shard->ghosts[slot] = lnode->id;
+	++shard->ghosts_count;
+	}/*ncache_ghost_add*/
+/*----------------------------------------------------------------------------*/
+/*Checks whether `lnode` is a ghost in `shard` (which must be locked) and
+	forgets the ghost if so*/
+static
+int
+ncache_ghost_claim
+	(
+	ncache_shard_t * shard,
+	lnode_t * lnode
+	)
+	{
+	/*Lookup the position of the ghost*/
+	int slot = (int)(long)hurd_ihash_find
+		(&shard->ghosts_index, (hurd_ihash_key_t)lnode->id);
+	
+	/*If there is no such ghost, stop*/
+	if(slot == 0)
+		return 0;
+	
+	/*Forget the ghost; the slot stays occupied until it gets to the old end
+		of the ring*/
+	hurd_ihash_remove(&shard->ghosts_index, (hurd_ihash_key_t)lnode->id);
+	shard->ghosts[slot - 1] = 0;
+	
+	/*The ghost has been found*/
+	return 1;
+	}/*ncache_ghost_claim*/
+/*----------------------------------------------------------------------------*/
+/*Evicts nodes from `shard` (which must be locked) until it fits into its
+	maximal size*/
+static
+void
+ncache_shard_shrink
+	(
+	ncache_shard_t * shard
+	)
+	{
+	/*The node being evicted*/
+	node_t * victim;
+	
+	/*While the size of the shard is exceeding the maximal size or the byte
+		budget and there is still something to evict*/
+	while
+		(
+		(shard->main.size_current + shard->in.size_current > 0)
+		&& ((shard->main.size_current + shard->in.size_current > shard->size_max)
+			|| ((shard->bytes_max > 0) && (shard->bytes_current > shard->bytes_max)))
+		)
+		{
+		/*If the FIFO of new nodes is longer than allowed, or there is
+			nothing else to evict, evict from it and remember the ghost*/
+		if
+			(
+			(shard->in.size_current > 0)
+			&& ((shard->in.size_current > shard->in_size_max)
+				|| (shard->main.size_current == 0))
+			)
+			{
+			victim = shard->in.lru;
+			ncache_ghost_add(shard, victim->nn->lnode);
+			}
+		else
+			/*evict the least recently used node*/
+			victim = shard->main.lru;
+	
+		/*remove the victim from the cache*/
+		ncache_node_remove(shard, victim);
+		
+		/*release the reference to the node owned by the cache*/
+		netfs_nrele(victim);
+		}
+	}/*ncache_shard_shrink*/
+/*----------------------------------------------------------------------------*/
+/*Applies the current limits of the cache (which must be locked) to all
+	shards, evicting the nodes which do not fit any longer*/
+static
+void
+ncache_shards_shrink
+	(
+	int ghosts_reset	/*recreate the rings of ghosts, too*/
+	)
+	{
+	int i;
+
+	/*Go through all shards*/
+	for(i = 0; i < NCACHE_SHARDS; ++i)
+		{
+		mutex_lock(&ncache.shards[i].lock);
+		
+		/*recompute the limits of the shard and evict the extra nodes*/
+		ncache_shard_limits_set(i);
+		if(ghosts_reset)
+			ncache_shard_ghosts_reset(&ncache.shards[i]);
+		ncache_shard_shrink(&ncache.shards[i]);
+		
+		mutex_unlock(&ncache.shards[i].lock);
+		}
+	}/*ncache_shards_shrink*/
+/*----------------------------------------------------------------------------*/
+/*Checks whether the translator is using more memory than the watermark
+	allows and adapts the effective byte budget of the cache (which must be
+	locked) accordingly*/
+static
+void
+ncache_pressure_check(void)
+	{
+	/*Basic information about our task*/
+	struct task_basic_info info;
+	mach_msg_type_number_t info_count = TASK_BASIC_INFO_COUNT;
+	
+	/*The new effective budget*/
+	size_t bytes = ncache.bytes_effective;
+	
+	/*If there is no watermark or no budget, there is nothing to adapt*/
+	if((ncache.watermark == 0) || (ncache.bytes_max == 0))
+		return;
+		
+	/*Obtain the resident size of the translator*/
+	if
+		(
+		task_info
+			(mach_task_self(), TASK_BASIC_INFO, (task_info_t)&info, &info_count)
+		)
+		return;
+	
+	/*If the watermark has been exceeded, halve the budget; if the pressure is
+		gone, grow the budget back towards the value requested by the user*/
+	if(info.resident_size > ncache.watermark)
+		{
+		bytes /= 2;
+		if(bytes < NCACHE_BYTES_MIN)
+			bytes = NCACHE_BYTES_MIN;
+		}
+	else if(bytes < ncache.bytes_max)
+		{
+		bytes *= 2;
+		if(bytes > ncache.bytes_max)
+			bytes = ncache.bytes_max;
+		}
+	
+	/*If the budget did not change, stop*/
+	if(bytes == ncache.bytes_effective)
+		return;
+		
+	LOG_MSG("ncache_pressure_check: Resident size %lu, cache budget %lu.",
+		(unsigned long)info.resident_size, (unsigned long)bytes);
+	
+	/*Apply the new budget*/
+	ncache.bytes_effective = bytes;
+	ncache_shards_shrink(0);
+	}/*ncache_pressure_check*/
+/*----------------------------------------------------------------------------*/
+/*Changes the limits of the cache, evicting nodes to fit into the new ones*/
+void
+ncache_resize
+	(
+	int size_max,				/*the maximal number of nodes*/
+	size_t bytes_max,		/*the byte budget (0 means no budget)*/
+	size_t watermark		/*the memory watermark (0 means none)*/
+	)
+	{
+	mutex_lock(&ncache.lock);
+	
+	/*If nothing changes, do not disturb the cache*/
+	if
+		(
+		(size_max == ncache.size_max) && (bytes_max == ncache.bytes_max)
+		&& (watermark == ncache.watermark)
+		)
+		{
+		mutex_unlock(&ncache.lock);
+		return;
+		}
+
+	LOG_MSG("ncache_resize: %d nodes, %lu bytes, watermark %lu.", size_max,
+		(unsigned long)bytes_max, (unsigned long)watermark);
+
+	/*Store the new limits*/
+	ncache.size_max = size_max;
+	ncache.bytes_max = ncache.bytes_effective = bytes_max;
+	ncache.watermark = watermark;
+	
+	/*Apply them to the shards; the rings of ghosts depend on the size*/
+	ncache_shards_shrink(1);
+	
+	mutex_unlock(&ncache.lock);
+	}/*ncache_resize*/
+/*----------------------------------------------------------------------------*/
 /*Resets the node cache*/
 void
 ncache_reset(void)
@@ -145,14 +543,47 @@ ncache_reset(void)
 	/*The node being currently deleted*/
 	node_t * node;
 	
-	/*Acquire a lock on the cache*/
-	mutex_lock(&ncache.lock);
+	int i;
+	
+	/*Everything cached about the nodes and the entries not in the cache of
+		nodes is stale now; it is found out when it is next used*/
+	lnode_invalidate_all();
 	
-	/*Remove the whole cache chain*/
-	for(node = ncache.mru; node != NULL; ncache_node_remove(node), node = ncache.mru);
+	/*Go through all shards*/
+	for(i = 0; i < NCACHE_SHARDS; ++i)
+		{
+		ncache_shard_t * shard = &ncache.shards[i];
 
-	/*Release the lock*/
-	mutex_unlock(&ncache.lock);
+		/*acquire a lock on the shard*/
+		mutex_lock(&shard->lock);
+		
+		/*remove the whole cache chains, dropping the references held by them*/
+		for
+			(
+			node = shard->main.mru; node != NULL;
+			ncache_node_remove(shard, node), netfs_nrele(node),
+				node = shard->main.mru
+			);
+		for
+			(
+			node = shard->in.mru; node != NULL;
+			ncache_node_remove(shard, node), netfs_nrele(node),
+				node = shard->in.mru
+			);
+			
+		/*forget all ghosts*/
+		for(; shard->ghosts_count > 0; --shard->ghosts_count)
+			{
+			if(shard->ghosts[shard->ghosts_first])
+				hurd_ihash_remove
+					(&shard->ghosts_index,
+					(hurd_ihash_key_t)shard->ghosts[shard->ghosts_first]);
+			shard->ghosts_first = (shard->ghosts_first + 1) % shard->ghosts_max;
+			}
+
+		/*release the lock*/
+		mutex_unlock(&shard->lock);
+		}
 	}/*ncache_reset*/
 /*----------------------------------------------------------------------------*/
 /*Adds the given node to the cache*/
@@ -162,60 +593,93 @@ ncache_node_add
 	node_t * node	/*the node to add*/
 	)
 	{
-	/*Acquire a lock on the cache*/
-	mutex_lock(&ncache.lock);
+	/*Find the shard responsible for this node*/
+	ncache_shard_t * shard = NCACHE_SHARD(node->nn->lnode);
+	
+	/*Estimate the current cost of the node*/
+	size_t cost;
+	
+	/*Whether the memory pressure is to be checked now*/
+	int pressure_check;
+	
+	/*The estimate is approximate anyway, so compute it without the lock*/
+	cost = node_cost(node);
+	
+	/*Acquire a lock on the shard*/
+	mutex_lock(&shard->lock);
 	
-	/*If there already are some nodes in the cache and it is enabled*/
-	if((ncache.size_max > 0) || (ncache.size_current > 0))
+	/*Check the memory pressure from time to time; each shard counts its own
+		additions, so that the lock of the whole cache is only taken once in a
+		while*/
+	pressure_check = (++shard->pressure_count >= NCACHE_PRESSURE_PERIOD);
+	if(pressure_check)
+		shard->pressure_count = 0;
+	
+	/*If there already are some nodes in the shard or it is enabled*/
+	if
+		(
+		(shard->size_max > 0)
+		|| (shard->main.size_current + shard->in.size_current > 0)
+		)
 		{
-		/*If the node to be added is not at the MRU end already*/
-		if(ncache.mru != node)
+		/*If the node is in the cache, the resources attached to it might
+			have changed; charge the difference*/
+		if(node->nn->ncache_list != NCACHE_LIST_NONE)
 			{
-			/*If the node is correctly integrated in the cache*/
-			if((node->nn->ncache_next != NULL) && (node->nn->ncache_prev != NULL))
-				/*remove the old entry*/
-				ncache_node_remove(node);
-			else
-				/*add a new reference to the node*/
-				netfs_nref(node);
-			
-			/*put the node at the MRU end of the cache chain*/
-			node->nn->ncache_next = ncache.mru;
-			node->nn->ncache_prev = NULL;
-		
-			/*setup the pointer in the old MRU end, if it exists*/
-			if(ncache.mru != NULL)
-				ncache.mru->nn->ncache_prev = node;
-			
-			/*setup the LRU end of the cache chain, if it did not exist previously*/
-			if(ncache.lru == NULL)
-				ncache.lru = node;
+			shard->bytes_current += cost - node->nn->ncache_cost;
+			node->nn->ncache_cost = cost;
+			}
+
+		/*If the node is in the FIFO of new nodes, leave it there: repeated
+			references in a short period do not make it hot*/
+		if(node->nn->ncache_list == NCACHE_LIST_IN)
+			;
+		/*If the node is in the LRU chain, move it to the MRU end*/
+		else if(node->nn->ncache_list == NCACHE_LIST_MAIN)
+			{
+			if(shard->main.mru != node)
+				{
+				ncache_node_remove(shard, node);
+				ncache_node_push(shard, node, NCACHE_LIST_MAIN);
+				}
+			}
+		/*The node is new to the cache*/
+		else
+			{
+			/*the cache will own a reference to the node*/
+			netfs_nref(node);
 			
-			/*shift the MRU end to the new node*/
-			ncache.mru = node;
-		
-			/*count the addition*/
-			++ncache.size_current;
+			/*Under LRU, or if the node has been evicted from the FIFO
+				recently and is referenced again, it goes to the LRU chain;
+				otherwise it has to prove itself in the FIFO first*/
+			if
+				(
+				(ncache.policy == NCACHE_POLICY_LRU)
+				|| ncache_ghost_claim(shard, node->nn->lnode)
+				)
+				ncache_node_push(shard, node, NCACHE_LIST_MAIN);
+			else
+				ncache_node_push(shard, node, NCACHE_LIST_IN);
+				
+			/*charge the node to the shard*/
+			node->nn->ncache_cost = cost;
+			shard->bytes_current += cost;
 			}
 		}
 		
-	/*While the size of the cache is exceeding the maximal size*/
-	node_t * old_lru;
-	for
-		(
-		old_lru = ncache.lru;
-		ncache.size_current > ncache.size_max;
-		old_lru = ncache.lru
-		)
-		{
-		/*remove the current LRU end of the list from the cache*/
-		ncache_node_remove(old_lru);
+	/*Evict the nodes which do not fit into the shard any longer*/
+	ncache_shard_shrink(shard);
 		
-		/*release the reference to the node owned by this thread*/
-		netfs_nrele(old_lru);
+	/*Release the lock on the shard*/
+	mutex_unlock(&shard->lock);
+	
+	/*The lock of the whole cache is acquired before the locks of the
+		shards*/
+	if(pressure_check)
+		{
+		mutex_lock(&ncache.lock);
+		ncache_pressure_check();
+		mutex_unlock(&ncache.lock);
 		}
-		
-	/*Release the lock on the cache*/
-	mutex_unlock(&ncache.lock);
 	}/*ncache_node_add*/
 /*----------------------------------------------------------------------------*/
@@ -29,6 +29,7 @@
 /*----------------------------------------------------------------------------*/
 #include <error.h>
 #include <hurd/netfs.h>
+#include <hurd/ihash.h>
 /*----------------------------------------------------------------------------*/
 #include "node.h"
 /*----------------------------------------------------------------------------*/
@@ -38,10 +39,35 @@
 /*The default maximal cache size*/
 #define NCACHE_SIZE 256
 /*----------------------------------------------------------------------------*/
+/*The default byte budget of the cache*/
+#define NCACHE_BYTES (1024 * 1024)
+/*----------------------------------------------------------------------------*/
+/*The byte budget below which memory pressure never shrinks the cache*/
+#define NCACHE_BYTES_MIN (64 * 1024)
+/*----------------------------------------------------------------------------*/
+/*The number of additions to a shard between two checks of memory
+	pressure*/
+#define NCACHE_PRESSURE_PERIOD 64
+/*----------------------------------------------------------------------------*/
+/*The number of independently locked shards of the cache*/
+#define NCACHE_SHARDS 16
+/*----------------------------------------------------------------------------*/
+/*The replacement policies of the cache*/
+#define NCACHE_POLICY_LRU	0	/*strict LRU*/
+#define NCACHE_POLICY_2Q	1	/*scan-resistant 2Q*/
+/*----------------------------------------------------------------------------*/
+/*The default replacement policy*/
+#define NCACHE_POLICY NCACHE_POLICY_LRU
+/*----------------------------------------------------------------------------*/
+/*The values of the `ncache_list` field of a netnode*/
+#define NCACHE_LIST_NONE	0	/*the node is not in the cache*/
+#define NCACHE_LIST_MAIN	1	/*the node is in the LRU chain of its shard*/
+#define NCACHE_LIST_IN		2	/*the node is in the FIFO of nodes seen once*/
+/*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*A cache chain*/
-struct ncache
+struct ncache_chain
 	{
 	/*the MRU end of the cache chain*/
 	node_t * mru;
@@ -49,14 +75,81 @@ struct ncache
 	/*the LRU end of the cache chain*/
 	node_t * lru;
 	
-	/*the maximal number of nodes to cache*/
-	int size_max;
-	
 	/*the current length of the cache chain*/
 	int size_current;
+	};/*struct ncache_chain*/
+/*----------------------------------------------------------------------------*/
+typedef struct ncache_chain ncache_chain_t;
+/*----------------------------------------------------------------------------*/
+/*A shard of the cache: a set of cache chains with its own lock*/
+/*Under the LRU policy only `main` is used. Under 2Q, nodes which have been
+	referenced once enter `in` (the A1in FIFO); when they fall out of it their
+	lnodes are remembered in the ring of ghosts (A1out), and a node whose lnode
+	is found among the ghosts goes directly to `main` (Am). Thus a single scan
+	over many nodes only cycles through `in` and leaves `main` untouched.*/
+struct ncache_shard
+	{
+	/*the LRU chain of nodes (the Am queue of 2Q)*/
+	ncache_chain_t main;
+	
+	/*the FIFO of nodes referenced only once (the A1in queue of 2Q)*/
+	ncache_chain_t in;
+	
+	/*the maximal number of nodes to cache in this shard*/
+	int size_max;
+	
+	/*the byte budget of this shard (0 means no budget) and the approximate
+		number of bytes occupied by the nodes in this shard*/
+	size_t bytes_max, bytes_current;
+	
+	/*the maximal length of `in`*/
+	int in_size_max;
+	
+	/*the ring of the identities of the lnodes recently evicted from `in`
+		(identities, unlike addresses, are not reused when lnodes are freed); 0
+		marks a ghost which has been promoted already*/
+	unsigned long * ghosts;
+	
+	/*the capacity of the ring, the index of the oldest ghost and the number
+		of ghosts in the ring*/
+	int ghosts_max, ghosts_first, ghosts_count;
+	
+	/*maps the identities of lnodes to their (1-based) positions in the ring
+		of ghosts*/
+	struct hurd_ihash ghosts_index;
+	
+	/*the number of additions to this shard since memory pressure was last
+		checked*/
+	int pressure_count;
 	
 	/*a lock*/
 	struct mutex lock;
+	};/*struct ncache_shard*/
+/*----------------------------------------------------------------------------*/
+typedef struct ncache_shard ncache_shard_t;
+/*----------------------------------------------------------------------------*/
+/*The cache: a set of shards selected by the hash of the lnode*/
+struct ncache
+	{
+	/*the shards*/
+	ncache_shard_t shards[NCACHE_SHARDS];
+	
+	/*the maximal number of nodes to cache (the sum over all shards)*/
+	int size_max;
+	
+	/*the byte budget requested by the user and the budget currently in effect,
+		which is smaller while the translator is under memory pressure*/
+	size_t bytes_max, bytes_effective;
+	
+	/*the resident size above which the cache shrinks (0 means never)*/
+	size_t watermark;
+	
+	/*the replacement policy (NCACHE_POLICY_*)*/
+	int policy;
+	
+	/*a lock protecting the limits of the whole cache (it is acquired before
+		the locks of the shards)*/
+	struct mutex lock;
 	};/*struct ncache*/
 /*----------------------------------------------------------------------------*/
 typedef struct ncache ncache_t;
@@ -67,6 +160,15 @@ typedef struct ncache ncache_t;
 /*The cache size (may be overwritten by the user)*/
 extern int cache_size;
 /*----------------------------------------------------------------------------*/
+/*The replacement policy of the cache (may be overwritten by the user)*/
+extern int ncache_policy;
+/*----------------------------------------------------------------------------*/
+/*The byte budget of the cache (may be overwritten by the user)*/
+extern size_t ncache_bytes;
+/*----------------------------------------------------------------------------*/
+/*The memory watermark for the cache (may be overwritten by the user)*/
+extern size_t ncache_watermark;
+/*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Functions-----------------------------------------------------------*/
@@ -90,6 +192,15 @@ ncache_node_lookup
 void
 ncache_reset(void);
 /*----------------------------------------------------------------------------*/
+/*Changes the limits of the cache, evicting nodes to fit into the new ones*/
+void
+ncache_resize
+	(
+	int size_max,				/*the maximal number of nodes*/
+	size_t bytes_max,		/*the byte budget (0 means no budget)*/
+	size_t watermark		/*the memory watermark (0 means none)*/
+	);
+/*----------------------------------------------------------------------------*/
 /*Adds the given node to the cache*/
 void
 ncache_node_add
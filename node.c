@@ -37,6 +37,12 @@
 #include "node.h"
 #include "options.h"
 #include "lib.h"
+#include "ncache.h"
+#include "pcache.h"
+#include "readahead.h"
+#include "writeback.h"
+#include "filter.h"
+#include "notify.h"
 #include "filterfs.h"
 /*----------------------------------------------------------------------------*/
 
@@ -45,6 +51,10 @@
 /*The lock protecting the underlying filesystem*/
 struct mutex ulfs_lock = MUTEX_INITIALIZER;
 /*----------------------------------------------------------------------------*/
+/*Nonzero if listing a directory also fetches the attributes of the accepted
+	entries (may be overwritten by the user)*/
+int readdir_plus = NODE_READDIR_PLUS;
+/*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Functions-----------------------------------------------------------*/
@@ -89,7 +99,26 @@ node_create
 		/*setup the references in the newly created node*/
 		node_new->nn->lnode = lnode;
 		node_new->nn->flags = 0;
+		node_new->nn->generation = 0;
 		node_new->nn->ncache_next = node_new->nn->ncache_prev = NULL;
+		node_new->nn->ncache_list = NCACHE_LIST_NONE;
+		node_new->nn->ncache_cost = 0;
+		node_new->nn->port = MACH_PORT_NULL;
+		node_new->nn->port_flags = 0;
+		node_new->nn->pcache_next = node_new->nn->pcache_prev = NULL;
+		node_new->nn->pcache_in = 0;
+		node_new->nn->ra = NULL;
+		node_new->nn->wb = NULL;
+		node_new->nn->listing = NULL;
+		node_new->nn->listing_size = 0;
+		node_new->nn->verdicts = NULL;
+		node_new->nn->verdicts_count = 0;
+		node_new->nn->verdicts_epoch = 0;
+		node_new->nn->flights = NULL;
+		condition_init(&node_new->nn->flights_done);
+		node_new->nn->clients = NULL;
+		node_new->nn->clients_tick = 0;
+		node_new->nn->notify = NULL;
 		
 		/*store the result of creation in the second parameter*/
 		*node = node_new;
@@ -107,11 +136,32 @@ node_destroy
 	node_t * np
 	)
 	{
-	/*Die if the node does not belong to node cache*/
-	assert(!np->nn->ncache_next || !np->nn->ncache_prev);
+	/*Die if the node still belongs to node cache*/
+	assert(np->nn->ncache_list == NCACHE_LIST_NONE);
+	
+	/*Nobody can be waiting for an evaluation in a node without references*/
+	assert(!np->nn->flights);
+	
+	/*The clients being notified hold a reference to the node*/
+	assert(!np->nn->clients);
+	
+	/*Drop the write-behind state (the data have been written already)*/
+	writeback_destroy(np);
 	
+	/*Stop watching the changes of the underlying directory*/
+	notify_unwatch(np);
+	
+	/*Drop the last listing and its verdicts*/
+	node_listing_drop(np);
+	free(np->nn->verdicts);
+
+	/*Drop the data fetched ahead*/
+	readahead_destroy(np);
+
 	/*Destroy the port to the underlying filesystem allocated to the node*/
-	PORT_DEALLOC(np->nn->port);
+	pcache_port_remove(np);
+	if(np->nn->port != MACH_PORT_NULL)
+		PORT_DEALLOC(np->nn->port);
 	
 	/*Lock the lnode corresponding to the current node*/
 	mutex_lock(&np->nn->lnode->lock);
@@ -296,183 +346,803 @@ node_entries_free
 		/*free the dirent stored in the current element of the list*/
 		free(dirent->dirent);
 		
+		/*release the lnode kept by the element*/
+		if(dirent->lnode)
+			{
+			mutex_lock(&dirent->lnode->lock);
+			lnode_ref_remove(dirent->lnode);
+			}
+		
 		/*free the current element*/
 		free(dirent);
 		}
 	}/*node_entries_free*/
 /*----------------------------------------------------------------------------*/
-/*Reads the directory entries from `node`, which must be locked*/
-error_t
-node_entries_get
+/*Finds the flight evaluating `name` (or listing, if `name` is NULL) in
+	`dir` (which must be locked) and joins it; returns NULL if there is no
+	such flight*/
+node_flight_t *
+node_flight_find
 	(
-	node_t * node,
-	node_dirent_t ** dirents /*store the result here*/
+	node_t * dir,
+	const char * name
 	)
 	{
-	error_t err = 0;
-
-	/*Obtain the path to the current node*/
-	char * path_to_node = node->nn->lnode->path;
-	
-	/*The number of PROPERTY_PARAMs in the property*/
-	int param_entries_count = 0;
+	/*The flight being looked at*/
+	node_flight_t * flight;
 	
-	/*The length of the property*/
-	size_t property_len = (property) ? (strlen(property)) : (0);
-	
-	/*The length of PROPERTY_PARAM*/
-	size_t property_param_len = strlen(PROPERTY_PARAM);
-
-	/*The full name and the filtering command*/
-	char * full_name = NULL, * cmd = NULL;
-
-	/*The lengths of the full name and the filtering command in chunks*/
-	size_t full_name_size = 1, cmd_size = 1;
-
-	/*If some property was indeed specified*/
-	if(property_len != 0)
+	/*Look for a flight with the same key*/
+	for(flight = dir->nn->flights; flight; flight = flight->next)
+		if
+			(
+			(!name && !flight->name)
+			|| (name && flight->name && (strcmp(name, flight->name) == 0))
+			)
+			{
+			/*join the flight*/
+			++flight->refs;
+			break;
+			}
+			
+	return flight;
+	}/*node_flight_find*/
+/*----------------------------------------------------------------------------*/
+/*Starts a flight evaluating `name` (or listing, if `name` is NULL) in `dir`
+	(which must be locked); returns NULL if there is not enough memory, in
+	which case the evaluation simply goes on without coalescing*/
+node_flight_t *
+node_flight_start
+	(
+	node_t * dir,
+	const char * name
+	)
+	{
+	/*Create the flight*/
+	node_flight_t * flight = malloc(sizeof(node_flight_t));
+	if(!flight)
+		return NULL;
+	flight->name = NULL;
+	if(name)
 		{
-		/*the pointer to the current occurrence of PROPERTY_PARAM*/
-		char * occurrence = strstr(property, PROPERTY_PARAM);
-		
-		/*count the number of occurrences*/
-		for(; occurrence;
-			occurrence = strstr(occurrence + 1, PROPERTY_PARAM),
-			++param_entries_count);
-
-		/*try allocate the memory for the fullname and the filtering command*/
-		full_name = malloc(full_name_size * STRING_CHUNK);
-		if(!full_name)
-			return ENOMEM;
-
-		cmd = malloc(cmd_size * STRING_CHUNK);
-		if(!cmd)
+		flight->name = strdup(name);
+		if(!flight->name)
 			{
-			free(full_name);
-			return ENOMEM;
+			free(flight);
+			return NULL;
 			}
 		}
-
-	/*Obtain the length of the path*/
-	size_t pathlen = strlen(path_to_node);
-
-	/*Checks if the given file satisfies the property. Zero value means that
-		the entry must be filtered out*/
-	int
-	check_property
-		(
-		const char * name	/*the name of the file*/
-		)
+	flight->done = flight->good = 0;
+	flight->err = 0;
+	
+	/*The leader uses the flight*/
+	flight->refs = 1;
+	
+	/*Register the flight in the directory*/
+	flight->next = dir->nn->flights;
+	dir->nn->flights = flight;
+	
+	return flight;
+	}/*node_flight_start*/
+/*----------------------------------------------------------------------------*/
+/*Waits until `flight` in `dir` (which must be locked; the lock is released
+	while waiting) completes*/
+void
+node_flight_wait
+	(
+	node_t * dir,
+	node_flight_t * flight
+	)
+	{
+	while(!flight->done)
+		condition_wait(&dir->nn->flights_done, &dir->lock);
+	}/*node_flight_wait*/
+/*----------------------------------------------------------------------------*/
+/*Completes `flight` in `dir` (which must be locked) with the given result,
+	wakes up the followers and leaves the flight*/
+void
+node_flight_land
+	(
+	node_t * dir,
+	node_flight_t * flight,
+	int good,
+	error_t err
+	)
+	{
+	/*The link pointing to the flight in the list*/
+	node_flight_t ** link;
+	
+	/*Store the result*/
+	flight->good = good;
+	flight->err = err;
+	flight->done = 1;
+	
+	/*Unregister the flight, nobody may join it any more*/
+	for(link = &dir->nn->flights; *link != flight; link = &(*link)->next);
+	*link = flight->next;
+	
+	/*Wake up the followers*/
+	condition_broadcast(&dir->nn->flights_done);
+	
+	/*The leader does not use the flight any more*/
+	node_flight_release(flight);
+	}/*node_flight_land*/
+/*----------------------------------------------------------------------------*/
+/*Leaves `flight`, freeing it if nobody else uses it (the directory must be
+	locked)*/
+void
+node_flight_release
+	(
+	node_flight_t * flight
+	)
+	{
+	if(--flight->refs == 0)
 		{
-		/*If there is no property*/
-		if(!property)
-			/*no filtering will be applied, any name is OK*/
-			return 0;
+		free(flight->name);
+		free(flight);
+		}
+	}/*node_flight_release*/
+/*----------------------------------------------------------------------------*/
+/*Drops the list of entries kept in `node` (which must be locked)*/
+void
+node_listing_drop
+	(
+	node_t * node
+	)
+	{
+	if(node->nn->listing)
+		node_entries_free(node->nn->listing);
+	node->nn->listing = NULL;
+	node->nn->listing_size = 0;
+	++node->nn->listing_generation;
+	}/*node_listing_drop*/
+/*----------------------------------------------------------------------------*/
+/*Computes the hash of the name of an entry*/
+static
+unsigned long
+node_name_hash
+	(
+	const char * name
+	)
+	{
+	unsigned long hash = 5381;
+	
+	for(; *name; ++name)
+		hash = hash * 33 + (unsigned char)*name;
+		
+	return hash;
+	}/*node_name_hash*/
+/*----------------------------------------------------------------------------*/
+/*Orders the verdicts by the identity of the entries, the hash of the name
+	first, so that all entries with a name are found together*/
+static
+int
+node_verdict_compare
+	(
+	const void * a,
+	const void * b
+	)
+	{
+	const node_verdict_t * va = a, * vb = b;
+	
+	if(va->hash != vb->hash)
+		return (va->hash < vb->hash) ? (-1) : (1);
+	if(va->ino != vb->ino)
+		return (va->ino < vb->ino) ? (-1) : (1);
+	return 0;
+	}/*node_verdict_compare*/
+/*----------------------------------------------------------------------------*/
+/*Returns the verdict found by the last listing of `dir` (which must be
+	locked) on the entry `name` with the inode number `ino`, if it was
+	obtained under the property with the epoch `epoch`; returns
+	LNODE_VERDICT_UNKNOWN otherwise*/
+static
+int
+node_verdict_find
+	(
+	node_t * dir,
+	ino_t ino,
+	const char * name,
+	unsigned long epoch
+	)
+	{
+	/*The identity of the entry and its verdict*/
+	node_verdict_t key, * found;
+	
+	if(!dir->nn->verdicts || (dir->nn->verdicts_epoch != epoch))
+		return LNODE_VERDICT_UNKNOWN;
 		
-		/*Everything OK at first*/
-		err = 0;
+	key.ino = ino;
+	key.hash = node_name_hash(name);
+	found = bsearch
+		(
+		&key, dir->nn->verdicts, dir->nn->verdicts_count,
+		sizeof(node_verdict_t), node_verdict_compare
+		);
 		
-		/*Compute the length of the full name once*/
-		size_t full_name_len = pathlen + 1 + strlen(name) + 1;
-
-		/*See how much space (in chunks) is required for the full name*/
-		int chunks = full_name_size;
-		for(; full_name_len > chunks * STRING_CHUNK; ++chunks);
+	if(!found)
+		return LNODE_VERDICT_UNKNOWN;
+	return (found->good) ? (LNODE_VERDICT_GOOD) : (LNODE_VERDICT_BAD);
+	}/*node_verdict_find*/
+/*----------------------------------------------------------------------------*/
+/*Replaces the verdicts kept in `dir` (which must be locked) with the ones
+	found by a listing of the `count` entries in `dirent_list` under the
+	property with the epoch `epoch`; entries without a verdict are skipped*/
+static
+void
+node_verdicts_store
+	(
+	node_t * dir,
+	struct dirent ** dirent_list,
+	int * verdicts,
+	size_t count,
+	unsigned long epoch
+	)
+	{
+	/*The new verdicts and their number*/
+	node_verdict_t * snapshot;
+	size_t n = 0, i;
+	
+	/*Drop the old verdicts*/
+	free(dir->nn->verdicts);
+	dir->nn->verdicts = NULL;
+	dir->nn->verdicts_count = 0;
+	
+	snapshot = malloc((count + 1) * sizeof(node_verdict_t));
+	if(!snapshot)
+		return;
 		
-		/*If more memory is requied*/
-		if(chunks > full_name_size)
+	/*Copy the verdicts on the real entries ('.' and '..' have none)*/
+	for(i = 0; i < count; ++i)
+		if
+			(
+			(verdicts[i] != LNODE_VERDICT_UNKNOWN)
+			&& (strcmp(dirent_list[i]->d_name, ".") != 0)
+			&& (strcmp(dirent_list[i]->d_name, "..") != 0)
+			)
 			{
-			/*free the old full name*/
-			free(full_name);
-
-			/*try to allocate the new memory*/
-			full_name = malloc(chunks * STRING_CHUNK);
-			if(!full_name)
-				{
-				err = ENOMEM;
-				free(cmd); /*the string for the command is definitely allocated here*/
-				return 0;
-				}
-			
-			/*store the new size*/
-			full_name_size = chunks;
+			snapshot[n].ino = dirent_list[i]->d_ino;
+			snapshot[n].hash = node_name_hash(dirent_list[i]->d_name);
+			snapshot[n].good = (verdicts[i] == LNODE_VERDICT_GOOD);
+			++n;
 			}
+	
+	/*Sort them for the lookup*/
+	qsort(snapshot, n, sizeof(node_verdict_t), node_verdict_compare);
+	
+	dir->nn->verdicts = snapshot;
+	dir->nn->verdicts_count = n;
+	dir->nn->verdicts_epoch = epoch;
+	}/*node_verdicts_store*/
+/*----------------------------------------------------------------------------*/
+/*Returns the position of the first verdict kept in `dir` (which must be
+	locked) whose entry is not ordered before the entry with the hash of the
+	name `hash` and the inode number `ino`*/
+static
+size_t
+node_verdict_position
+	(
+	node_t * dir,
+	unsigned long hash,
+	ino_t ino
+	)
+	{
+	/*The identity looked for*/
+	node_verdict_t key;
+	
+	/*The bounds of the range searched*/
+	size_t low = 0, high = dir->nn->verdicts_count, mid;
+	
+	key.hash = hash;
+	key.ino = ino;
+	
+	/*Halve the range until it is empty*/
+	while(low < high)
+		{
+		mid = (low + high) / 2;
+		if(node_verdict_compare(&dir->nn->verdicts[mid], &key) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+		}
 		
-		/*Initialize `full_name` as a valid string*/
-		full_name[0] = 0;
+	return low;
+	}/*node_verdict_position*/
+/*----------------------------------------------------------------------------*/
+/*Records in the verdicts kept in `dir` (which must be locked) the verdict on
+	the new entry `name` with the inode number `ino`*/
+static
+void
+node_verdict_insert
+	(
+	node_t * dir,
+	ino_t ino,
+	const char * name,
+	int good
+	)
+	{
+	/*The identity of the entry and its position*/
+	unsigned long hash = node_name_hash(name);
+	size_t pos;
+	
+	/*The enlarged array of verdicts*/
+	node_verdict_t * verdicts;
+	
+	/*If no verdicts are kept, the next listing will obtain them*/
+	if(!dir->nn->verdicts)
+		return;
 		
-		/*Construct the full name*/
-		strcpy(full_name, path_to_node);
-		strcat(full_name, "/");
-		strcat(full_name, name);
+	/*If the entry is known, just update the verdict*/
+	pos = node_verdict_position(dir, hash, ino);
+	if
+		(
+		(pos < dir->nn->verdicts_count)
+		&& (dir->nn->verdicts[pos].hash == hash)
+		&& (dir->nn->verdicts[pos].ino == ino)
+		)
+		{
+		dir->nn->verdicts[pos].good = good;
+		return;
+		}
 		
-		/*LOG_MSG("node_entries_get: Applying filter to %s...", full_name);*/
+	/*Make room for the entry*/
+	verdicts = realloc
+		(dir->nn->verdicts, (dir->nn->verdicts_count + 1) * sizeof(node_verdict_t));
+	if(!verdicts)
+		return;
+	dir->nn->verdicts = verdicts;
+	memmove
+		(
+		verdicts + pos + 1, verdicts + pos,
+		(dir->nn->verdicts_count - pos) * sizeof(node_verdict_t)
+		);
+	++dir->nn->verdicts_count;
+	
+	/*Store the verdict*/
+	verdicts[pos].hash = hash;
+	verdicts[pos].ino = ino;
+	verdicts[pos].good = good;
+	}/*node_verdict_insert*/
+/*----------------------------------------------------------------------------*/
+/*Removes the verdicts on the entries called `name` from the verdicts kept in
+	`dir` (which must be locked); returns nonzero if one of them accepted the
+	entry under the current property*/
+static
+int
+node_verdict_remove
+	(
+	node_t * dir,
+	const char * name
+	)
+	{
+	/*The identity of the entry and the range of its verdicts*/
+	unsigned long hash = node_name_hash(name);
+	size_t first, last;
+	
+	/*Whether an accepting verdict has been removed*/
+	int good = 0;
+	
+	if(!dir->nn->verdicts)
+		return 0;
 		
-		/*Compute the space required for the final filtering command*/
-		size_t sz = property_len + (strlen(full_name) - property_param_len)
-			* param_entries_count;
+	/*Find all verdicts with the hash of the name (different names may share
+		the hash, so this is a guess on the safe side)*/
+	first = node_verdict_position(dir, hash, 0);
+	for
+		(
+		last = first;
+		(last < dir->nn->verdicts_count) && (dir->nn->verdicts[last].hash == hash);
+		++last
+		)
+		good |= dir->nn->verdicts[last].good;
+	if(dir->nn->verdicts_epoch != lnode_epoch(dir->nn->lnode))
+		good = 0;
+		
+	/*Close the gap*/
+	memmove
+		(
+		dir->nn->verdicts + first, dir->nn->verdicts + last,
+		(dir->nn->verdicts_count - last) * sizeof(node_verdict_t)
+		);
+	dir->nn->verdicts_count -= last - first;
+	
+	return good;
+	}/*node_verdict_remove*/
+/*----------------------------------------------------------------------------*/
+/*Returns the verdict on the entry `name` of `dir` (which must be locked)
+	recorded by the listing of `dir`, if the listing is still valid for the
+	modification time `dir_mtime` and the epoch `epoch`; returns
+	LNODE_VERDICT_UNKNOWN otherwise*/
+int
+node_verdict_lookup
+	(
+	node_t * dir,
+	const char * name,
+	struct timespec dir_mtime,
+	unsigned long epoch
+	)
+	{
+	/*The identity of the entry and the position of its verdict*/
+	unsigned long hash = node_name_hash(name);
+	size_t pos;
+	
+	/*Only the verdicts of a valid listing describe the directory*/
+	if
+		(
+		!dir->nn->listing || !dir->nn->verdicts
+		|| !TIMESPEC_EQUAL(dir->nn->listing_dir_mtime, dir_mtime)
+		|| (dir->nn->listing_epoch != epoch)
+		|| (dir->nn->verdicts_epoch != epoch)
+		)
+		return LNODE_VERDICT_UNKNOWN;
 		
-		/*See how much space (in chunks) is required for the command*/
-		for(chunks = cmd_size; sz > chunks * STRING_CHUNK; ++chunks);
+	/*The verdict is known if exactly one entry has the hash of the name*/
+	pos = node_verdict_position(dir, hash, 0);
+	if
+		(
+		(pos >= dir->nn->verdicts_count) || (dir->nn->verdicts[pos].hash != hash)
+		|| ((pos + 1 < dir->nn->verdicts_count)
+			&& (dir->nn->verdicts[pos + 1].hash == hash))
+		)
+		return LNODE_VERDICT_UNKNOWN;
 		
-		/*If more memory is requied*/
-		if(chunks > cmd_size)
+	return (dir->nn->verdicts[pos].good)
+		? (LNODE_VERDICT_GOOD) : (LNODE_VERDICT_BAD);
+	}/*node_verdict_lookup*/
+/*----------------------------------------------------------------------------*/
+/*Replaces the listing of `dir` (which must be locked) with a copy in which
+	the entry `removed` (if any) is a hole and `added` (if any) follows the
+	last entry. The listing is never changed once it has been handed out,
+	and the entries keep their positions in the copy, so a client reading the
+	directory in several calls neither misses nor repeats any of them (the
+	holes have zero inode numbers, which readdir skips)*/
+static
+error_t
+node_listing_edit
+	(
+	node_t * dir,
+	node_dirent_t * removed,
+	node_dirent_t * added
+	)
+	{
+	/*The copy, the link to its end and the current elements*/
+	node_dirent_t * copy = NULL, ** tail = &copy, * dirent, * next, * e;
+	
+	/*The dirent standing in place of the removed entry*/
+	struct dirent * hole = NULL;
+	
+	if(removed)
+		{
+		hole = malloc(removed->dirent->d_reclen);
+		if(!hole)
+			return ENOMEM;
+		memcpy(hole, removed->dirent, removed->dirent->d_reclen);
+		hole->d_ino = 0;
+		}
+	
+	/*Copy the elements; the dirents and the lnodes pass to the copy*/
+	for(dirent = dir->nn->listing; dirent; dirent = dirent->next)
+		{
+		e = malloc(sizeof(node_dirent_t));
+		if(!e)
 			{
-			/*free the old command*/
-			free(cmd);
-
-			/*try to allocate the new memory*/
-			cmd = malloc(chunks * STRING_CHUNK);
-			if(!cmd)
+			for(; copy; copy = next)
 				{
-				err = ENOMEM;
-				free(full_name);	/*the string for the full name is
-														definitely allocated here*/
-				return 0;
+				next = copy->next;
+				free(copy);
 				}
-			
-			/*store the new size*/
-			cmd_size = chunks;
+			free(hole);
+			return ENOMEM;
 			}
-
-		/*Initialize `cmd` as a valid string*/
-		cmd[0] = 0;
+		*e = *dirent;
+		e->next = NULL;
+		if(dirent == removed)
+			{
+			e->dirent = hole;
+			e->lnode = NULL;
+			dir->nn->listing_size += NODE_DIRENT_SIZE(e);
+			}
+		*tail = e;
+		tail = &e->next;
+		}
+	if(added)
+		{
+		added->next = NULL;
+		*tail = added;
+		dir->nn->listing_size += NODE_DIRENT_SIZE(added);
+		}
+	
+	/*Free the old elements, together with what the removed entry owned*/
+	for(dirent = dir->nn->listing; dirent; dirent = next)
+		{
+		next = dirent->next;
+		if(dirent == removed)
+			{
+			dir->nn->listing_size -= NODE_DIRENT_SIZE(dirent);
+			dirent->next = NULL;
+			node_entries_free(dirent);
+			}
+		else
+			free(dirent);
+		}
+		
+	dir->nn->listing = copy;
+	return 0;
+	}/*node_listing_edit*/
+/*----------------------------------------------------------------------------*/
+/*Forgets everything known about the entry `name` of `dir` (which must be
+	locked), which has been removed from the underlying directory; returns
+	nonzero if the entry was in the filtered view of the directory*/
+int
+node_entry_removed
+	(
+	node_t * dir,
+	const char * name
+	)
+	{
+	/*The lnode of the entry*/
+	lnode_t * lnode;
+	
+	/*The entry in the listing*/
+	node_dirent_t * dirent;
+	
+	/*Whether the entry was accepted by a lookup or a listing*/
+	int shown = 0;
+	
+	/*The epoch the verdicts on the entries of the directory are valid in*/
+	unsigned long epoch = lnode_epoch(dir->nn->lnode);
+	
+	/*Forget the verdict and the attributes, as well as everything cached
+		below the entry, if it was a directory*/
+	if(lnode_get(dir->nn->lnode, (char *)name, &lnode) == 0)
+		{
+		shown = lnode_verdict_invalidate(lnode, epoch) == LNODE_VERDICT_GOOD;
+		lnode_stat_invalidate(lnode);
+		lnode_invalidate(lnode);
+		lnode_ref_remove(lnode);
+		}
+	shown |= node_verdict_remove(dir, name);
+	
+	/*Leave a hole in place of the entry in the listing; if the listing
+		cannot be edited, it must go*/
+	for
+		(
+		dirent = dir->nn->listing;
+		dirent
+			&& (!dirent->dirent->d_ino
+				|| (strcmp(dirent->dirent->d_name, name) != 0));
+		dirent = dirent->next
+		);
+	if(dirent)
+		{
+		/*the listing has shown the entry*/
+		if(dir->nn->listing_epoch == epoch)
+			shown = 1;
 			
-		/*The current occurence of PROPERTY_PARAM in property*/
-		char * p = strstr(property, PROPERTY_PARAM);
+		if(node_listing_edit(dir, dirent, NULL) != 0)
+			node_listing_drop(dir);
+		}
 		
-		/*The pointer to the current position in the property*/
-		char * propp = property;
+	return shown;
+	}/*node_entry_removed*/
+/*----------------------------------------------------------------------------*/
+/*Evaluates the new entry `name` of `dir` (which must be locked; the lock is
+	released while the filter runs) and adds it to the listing and the
+	verdicts kept in `dir`; sets `good` to nonzero if the entry is accepted*/
+error_t
+node_entry_added
+	(
+	node_t * dir,
+	const char * name,
+	int * good
+	)
+	{
+	error_t err;
+	
+	/*The attributes of the entry and the port to it*/
+	io_statbuf_t stat;
+	file_t p;
+	
+	/*The copy of the path to the directory, the rule applying to its entries
+		and the epoch the verdict is obtained in*/
+	char * path;
+	int rule;
+	unsigned long epoch = lnode_epoch(dir->nn->lnode);
+	
+	/*Whether there is a listing to add the entry to and its generation*/
+	int listed;
+	unsigned long generation;
+	
+	/*The element of the listing describing the entry*/
+	node_dirent_t * node_dirent_new;
+	
+	/*The new dirent and its size*/
+	struct dirent * dirent_new;
+	size_t size;
+	
+	/*Nothing is accepted unless the filter says so*/
+	*good = 0;
+	
+	/*An entry with the same name might have been there*/
+	node_entry_removed(dir, name);
+	
+	/*Find out what the entry is*/
+	err = node_port_ensure(dir, O_READ | O_DIRECTORY);
+	if(err)
+		return err;
+	p = file_name_lookup_under(dir->nn->port, name, 0, 0);
+	if(p == MACH_PORT_NULL)
+		return errno;
+	err = io_stat(p, &stat);
+	PORT_DEALLOC(p);
+	if(err)
+		return err;
 		
-		/*While the command has not been constructed*/
-		for(; p; p = strstr(propp, PROPERTY_PARAM))
-			{
-			/*add the new part of the property to the command*/
-			strncat(cmd, propp, p - propp);
-			
-			/*add the filename to the command*/
-			strcat(cmd, full_name);
-			
-			/*LOG_MSG("\tcmd = '%s'", cmd);*/
-
-			/*advance the pointer in the property*/
-			propp = p + property_param_len;
-
-			/*LOG_MSG("\tpropp points at '%s'", propp);*/
-			}
+	/*Run the filter without holding the lock*/
+	err = lnode_rule(dir->nn->lnode, &rule);
+	if(err)
+		return err;
+	path = strdup(dir->nn->lnode->path);
+	if(!path)
+		return ENOMEM;
+	listed = (dir->nn->listing != NULL);
+	generation = dir->nn->listing_generation;
+	mutex_unlock(&dir->lock);
+	err = filter_check
+		(path, name, rule, FILTER_CLASS_BACKGROUND, FILTER_UID_NONE, good);
+	free(path);
+	mutex_lock(&dir->lock);
+	
+	/*If the property has changed or the cache has been invalidated meanwhile,
+		the verdict is worthless*/
+	if(err || (epoch != lnode_epoch(dir->nn->lnode)))
+		{
+		*good = 0;
+		return err;
+		}
 		
-		/*Copy the rest of the property to the command*/
-		strcat(cmd, propp);
+	/*Record the verdict*/
+	node_verdict_insert(dir, stat.st_ino, name, *good);
+	
+	/*Add an accepted entry at the end of the listing, unless the listing has
+		been dropped or built anew meanwhile (then the entry is in it already);
+		the entries edited in it meanwhile do not matter*/
+	if
+		(
+		!*good || !listed || !dir->nn->listing
+		|| (dir->nn->listing_generation != generation)
+		)
+		return 0;
 		
-		/*LOG_MSG("node_entries_get: The filtering command: '%s'.", cmd);*/
-
-		/*Execute the command*/
-		int xcode = WEXITSTATUS(system(cmd));
+	size = DIRENT_LEN(strlen(name));
+	node_dirent_new = malloc(sizeof(node_dirent_t));
+	dirent_new = malloc(size);
+	if(!node_dirent_new || !dirent_new)
+		{
+		free(node_dirent_new);
+		free(dirent_new);
 		
-		/*Return the exit code of the command*/
-		return xcode;
-		}/*check_property*/
+		/*the listing cannot be completed, so it must go*/
+		node_listing_drop(dir);
+		return ENOMEM;
+		}
+	dirent_new->d_ino			= stat.st_ino;
+	dirent_new->d_type		= IFTODT(stat.st_mode);
+	dirent_new->d_reclen	= size;
+	strcpy((char *)dirent_new + DIRENT_NAME_OFFS, name);
+	node_dirent_new->dirent = dirent_new;
+	node_dirent_new->lnode = NULL;
+	err = node_listing_edit(dir, NULL, node_dirent_new);
+	if(err)
+		{
+		node_entries_free(node_dirent_new);
+		node_listing_drop(dir);
+		}
+	
+	return err;
+	}/*node_entry_added*/
+/*----------------------------------------------------------------------------*/
+/*Makes the listing kept in `dir` (which must be locked) valid for the
+	current state of the directory, after the changes of the directory have
+	been applied to it; drops the listing if that cannot be done*/
+void
+node_listing_restamp
+	(
+	node_t * dir
+	)
+	{
+	error_t err;
+	
+	/*The attributes of the directory*/
+	io_statbuf_t stat;
+	
+	/*Obtain the current modification time*/
+	err = node_port_ensure(dir, O_READ | O_DIRECTORY);
+	if(!err)
+		err = io_stat(dir->nn->port, &stat);
+	if(err)
+		{
+		node_listing_drop(dir);
+		return;
+		}
+	lnode_stat_store(dir->nn->lnode, &stat);
+	
+	/*The listing describes the directory in its current state*/
+	if
+		(
+		dir->nn->listing
+		&& (dir->nn->listing_epoch == lnode_epoch(dir->nn->lnode))
+		)
+		dir->nn->listing_dir_mtime = stat.st_mtim;
+	}/*node_listing_restamp*/
+/*----------------------------------------------------------------------------*/
+/*Obtains the modification time of the directory `dir` (which must be
+	locked), from the cached attributes if possible; together with the epoch
+	of the property, it tells whether a recorded verdict may be trusted*/
+error_t
+node_dir_mtime_get
+	(
+	node_t * dir,
+	struct timespec * mtime
+	)
+	{
+	error_t err;
+	
+	/*The attributes of the directory*/
+	io_statbuf_t stat;
+	
+	/*If the attributes have not been cached recently, ask the underlying
+		directory and remember the answer*/
+	if(lnode_stat_fetch(dir->nn->lnode, &stat) != 0)
+		{
+		err = node_port_ensure(dir, O_READ | O_DIRECTORY);
+		if(!err)
+			err = io_stat(dir->nn->port, &stat);
+		if(err)
+			return err;
+			
+		lnode_stat_store(dir->nn->lnode, &stat);
+		}
+	
+	/*Return the modification time*/
+	*mtime = stat.st_mtim;
+	return 0;
+	}/*node_dir_mtime_get*/
+/*----------------------------------------------------------------------------*/
+/*Reads the directory entries from `node`, which must be locked. The verdict
+	on each entry is recorded in the lnode of the entry (lnodes are created
+	for the accepted entries), so that lookups and later listings need not
+	run the filter again while the directory does not change. The filter is
+	run without holding the lock of `node`; concurrent listings of the same
+	directory wait for the one in progress and share its result. The list is
+	kept in `node` while it is valid and must not be freed by the caller. If
+	`prefill` is nonzero and readdir_plus is set, the attributes of (at most
+	NODE_PREFILL_MAX of) the accepted entries are fetched while the lock is
+	released, too, and cached in their lnodes*/
+error_t
+node_entries_get
+	(
+	node_t * node,
+	uid_t uid, /*the user on whose behalf the filter runs*/
+	int klass, /*the class of the filter work (see filter.h)*/
+	node_dirent_t ** dirents, /*store the result here*/
+	int prefill
+	)
+	{
+	error_t err = 0;
 
+	/*The copy of the path to the current node (the lock of the node is
+		released while the filter runs) and the rule applying to its entries*/
+	char * path_to_node;
+	int rule;
+	
+	/*The validity token of the verdicts: the modification time of the
+		directory and the epoch of the property*/
+	struct timespec dir_mtime;
+	unsigned long epoch;
+	
+	/*The listing in progress*/
+	node_flight_t * flight;
+	
 	/*The list of dirents*/
 	struct dirent ** dirent_list, **dirent;
 	
@@ -484,12 +1154,100 @@ node_entries_get
 	
 	/*The array of dirents*/
 	char * dirent_data;
+	
+	/*The verdicts on the dirents, the flags telling which of them have just
+		been obtained, and the number of dirents*/
+	int * verdicts;
+	char * fresh;
+	size_t count, i;
+	
+	/*The checks of the dirents whose verdicts are not known and the error
+		of the current check*/
+	filter_job_t ** jobs;
+	error_t job_err;
+	
+	/*The attributes fetched for the accepted dirents, their number, the
+		(1-based) position of the attributes of each dirent (-1 if they are
+		cached already) and the port to the directory to fetch them through*/
+	io_statbuf_t * stats = NULL;
+	size_t stats_count = 0;
+	int * slots = NULL;
+	file_t port = MACH_PORT_NULL;
+	
+	/*The port to the current dirent and its cached attributes*/
+	file_t p;
+	io_statbuf_t stat;
+	
+	/*If the directory is being listed right now, wait for the result instead
+		of listing it once more*/
+	flight = node_flight_find(node, NULL);
+	if(flight)
+		{
+		node_flight_wait(node, flight);
+		node_flight_release(flight);
+		}
+
+	/*Make sure the port to the directory is open*/
+	err = node_port_ensure(node, O_READ | O_DIRECTORY);
+	if(err)
+		return err;
+		
+	/*Obtain the current validity token*/
+	err = node_dir_mtime_get(node, &dir_mtime);
+	if(err)
+		return err;
+	epoch = lnode_epoch(node->nn->lnode);
+	
+	/*If the last listing is still valid, it is the result*/
+	if
+		(
+		node->nn->listing
+		&& TIMESPEC_EQUAL(node->nn->listing_dir_mtime, dir_mtime)
+		&& (node->nn->listing_epoch == epoch)
+		)
+		{
+		*dirents = node->nn->listing;
+		return 0;
+		}
+		
+	/*The last listing is out of date*/
+	node_listing_drop(node);
+	
+	/*The attributes are fetched on request only*/
+	prefill = prefill && readdir_plus;
 
 	/*Obtain the directory entries for the given node*/
 	err = dir_entries_get
 		(node->nn->port, &dirent_data, &dirent_data_size, &dirent_list);
+	if(err)
+		return err;
+		
+	/*Prepare to store a verdict for each dirent*/
+	for(count = 0; dirent_list[count]; ++count);
+	verdicts = malloc((count + 1) * sizeof(int));
+	fresh = calloc(count + 1, 1);
+	jobs = calloc(count + 1, sizeof(filter_job_t *));
+	path_to_node = strdup(node->nn->lnode->path);
+	if(prefill)
+		{
+		stats = malloc(NODE_PREFILL_MAX * sizeof(io_statbuf_t));
+		slots = calloc(count + 1, sizeof(int));
+		}
+	if(!verdicts || !fresh || !jobs || !path_to_node
+		|| (prefill && (!stats || !slots)))
+		err = ENOMEM;
+	if(!err)
+		err = lnode_rule(node->nn->lnode, &rule);
 	if(err)
 		{
+		free(verdicts);
+		free(fresh);
+		free(jobs);
+		free(path_to_node);
+		free(stats);
+		free(slots);
+		free(dirent_list);
+		munmap(dirent_data, dirent_data_size);
 		return err;
 		}
 		
@@ -510,27 +1268,152 @@ node_entries_get
 	/*The size of the current dirent*/
 	size_t size;
 	
-	/*The exit code of property*/
+	/*The lnode of the current dirent (if there is one)*/
+	lnode_t * lnode;
+	
+	/*The verdict of the filter on the current dirent*/
 	int good;
 	
-	/*Go through all elements of the list of pointers to dirent*/
-	for(dirent = dirent_list; *dirent; ++dirent)
+	/*Find out which verdicts are known already (the directory node is locked,
+		so nobody else is changing the list of entries)*/
+	for(i = 0; i < count; ++i)
 		{
 		/*obtain the name of the current dirent*/
-		name = &((*dirent)->d_name[0]);
+		name = &(dirent_list[i]->d_name[0]);
 		
 		/*If the current dirent is either '.' or '..', skip it*/
+		verdicts[i] = LNODE_VERDICT_BAD;
 		if((strcmp(name, ".") == 0) ||	(strcmp(name, "..") == 0))
 			continue;
 		
-		/*check if the current dirent has the property*/
-		good = check_property(name);
-		if(err)
-			break;
- 		
+		/*if the entry has been seen before, its verdict may still hold*/
+		verdicts[i] = LNODE_VERDICT_UNKNOWN;
+		if(lnode_get(node->nn->lnode, name, &lnode) == 0)
+			{
+			verdicts[i] = lnode_verdict_fetch(lnode, dir_mtime, epoch);
+			
+			/*the attributes of the entry need not be fetched, if they are
+				cached*/
+			if(prefill && (lnode_stat_fetch(lnode, &stat) == 0))
+				slots[i] = -1;
+			lnode_ref_remove(lnode);
+			}
+			
+		/*if the directory has changed since, but the entry is the same, the
+			verdict of the last listing still holds; it is recorded anew*/
+		if(verdicts[i] == LNODE_VERDICT_UNKNOWN)
+			{
+			verdicts[i] = node_verdict_find
+				(node, dirent_list[i]->d_ino, name, epoch);
+			fresh[i] = (verdicts[i] != LNODE_VERDICT_UNKNOWN);
+			}
+		}
+	
+	/*Let other threads wait for this listing, and run the filter on the
+		entries whose verdicts are not known without holding the lock, so that
+		the directory can be used meanwhile*/
+	flight = node_flight_start(node, NULL);
+	if(prefill)
+		{
+		/*the port of the directory may be closed while the lock is released*/
+		port = node->nn->port;
+		mach_port_mod_refs(mach_task_self(), port, MACH_PORT_RIGHT_SEND, 1);
+		}
+	mutex_unlock(&node->lock);
+	
+	/*Hand all the checks to the executor at once, so that they run in
+		parallel, and only then collect the verdicts*/
+	for(i = 0; !err && (i < count); ++i)
+		if(verdicts[i] == LNODE_VERDICT_UNKNOWN)
+			err = filter_submit
+				(path_to_node, dirent_list[i]->d_name, rule, klass, uid, &jobs[i]);
+	
+	for(i = 0; i < count; ++i)
+		if(jobs[i])
+			{
+			/*every submitted job is waited for, even after an error, since
+				waiting frees it*/
+			job_err = filter_wait(jobs[i], &good);
+			if(job_err)
+				{
+				if(!err)
+					err = job_err;
+				continue;
+				}
+			verdicts[i] = (good) ? (LNODE_VERDICT_GOOD) : (LNODE_VERDICT_BAD);
+			fresh[i] = 1;
+			}
+	
+	/*Fetch the attributes of the accepted entries still without the lock, so
+		that lookups in the directory do not wait for them*/
+	for
+		(
+		i = 0;
+		prefill && !err && (i < count) && (stats_count < NODE_PREFILL_MAX);
+		++i
+		)
+		if((verdicts[i] == LNODE_VERDICT_GOOD) && (slots[i] == 0))
+			{
+			p = file_name_lookup_under(port, dirent_list[i]->d_name, 0, 0);
+			if(p == MACH_PORT_NULL)
+				continue;
+			if(io_stat(p, &stats[stats_count]) == 0)
+				slots[i] = ++stats_count;
+			PORT_DEALLOC(p);
+			}
+	if(port != MACH_PORT_NULL)
+		PORT_DEALLOC(port);
+	
+	mutex_lock(&node->lock);
+	
+	/*Go through all elements of the list of pointers to dirent*/
+	for(i = 0; !err && (i < count); ++i)
+		{
+		/*obtain the name of the current dirent*/
+		name = &(dirent_list[i]->d_name[0]);
+		
+		/*if the verdict has just been obtained, record it; an accepted entry
+			gets an lnode, in the same way the lookup does it, while a rejected
+			one does not, so that huge directories with few good entries do not
+			fill the tree*/
+		lnode = NULL;
+		if(fresh[i])
+			{
+			good = (verdicts[i] == LNODE_VERDICT_GOOD);
+			
+			if(lnode_get(node->nn->lnode, name, &lnode) != 0)
+				{
+				lnode = NULL;
+				if(good && (lnode_create(name, &lnode) == 0))
+					lnode_install(node->nn->lnode, lnode);
+				}
+			
+			if(lnode)
+				lnode_verdict_store(lnode, good, dir_mtime, epoch);
+			}
+		
 		/*If the current entry is not good, skip it*/
-		if(good != 0)
+		if(verdicts[i] != LNODE_VERDICT_GOOD)
+			{
+			if(lnode)
+				lnode_ref_remove(lnode);
 			continue;
+			}
+		
+		/*remember the attributes of the accepted entry, if they have been
+			fetched*/
+		if(prefill && (slots[i] > 0))
+			{
+			if(!lnode && (lnode_get(node->nn->lnode, name, &lnode) != 0))
+				lnode = NULL;
+			if(lnode)
+				lnode_stat_store(lnode, &stats[slots[i] - 1]);
+			}
+		
+		/*the listing keeps the lnode with what has been recorded about the
+			entry; it is released when the listing goes*/
+		if(lnode)
+			mutex_unlock(&lnode->lock);
 		
 		/*obtain the length of the current name*/
 		name_len = strlen(name);
@@ -542,6 +1425,11 @@ node_entries_get
 		node_dirent_new = malloc(sizeof(node_dirent_t));
 		if(!node_dirent_new)
 			{
+			if(lnode)
+				{
+				mutex_lock(&lnode->lock);
+				lnode_ref_remove(lnode);
+				}
 			err = ENOMEM;
 			break;
 			}
@@ -551,18 +1439,24 @@ node_entries_get
 		if(!dirent_new)
 			{
 			free(node_dirent_new);
+			if(lnode)
+				{
+				mutex_lock(&lnode->lock);
+				lnode_ref_remove(lnode);
+				}
 			err = ENOMEM;
 			break;
 			}
 			
 		/*fill the dirent with information*/
-		dirent_new->d_ino			= (*dirent)->d_ino;
-		dirent_new->d_type 		= (*dirent)->d_type;
+		dirent_new->d_ino			= dirent_list[i]->d_ino;
+		dirent_new->d_type 		= dirent_list[i]->d_type;
 		dirent_new->d_reclen	= size;
 		strcpy((char *)dirent_new + DIRENT_NAME_OFFS, name);
 		
 		/*add the dirent to the list*/
 		node_dirent_new->dirent = dirent_new;
+		node_dirent_new->lnode = lnode;
 		node_dirent_new->next = node_dirent_list;
 		node_dirent_list = node_dirent_new;
 		}
@@ -572,20 +1466,44 @@ node_entries_get
 		/*free the list of dirents*/
 		node_entries_free(node_dirent_list);
 	else
+		{
+		/*keep the list in the node while it is valid (another listing might
+			have stored its result while the lock was released)*/
+		node_listing_drop(node);
+		node->nn->listing = node_dirent_list;
+		for(; node_dirent_list; node_dirent_list = node_dirent_list->next)
+			node->nn->listing_size += NODE_DIRENT_SIZE(node_dirent_list);
+		node->nn->listing_dir_mtime = dir_mtime;
+		node->nn->listing_epoch = epoch;
+		
+		/*remember the verdicts on all entries for the next listing*/
+		node_verdicts_store(node, dirent_list, verdicts, count, epoch);
+		
+		/*keep the listing up to date as the directory changes*/
+		notify_watch(node);
+		
 		/*store the list of dirents in the second parameter*/
-		*dirents = node_dirent_list;
+		*dirents = node->nn->listing;
+		}
+		
+	/*The listing has completed; the followers will find its result in the
+		node*/
+	if(flight)
+		node_flight_land(node, flight, 0, err);
 	
 	/*Free the list of pointers to dirent*/
 	free(dirent_list);
 	
 	/*Free the results of listing the dirents*/
 	munmap(dirent_data, dirent_data_size);
-
-	/*Free the full name and the command (if these are present at all)*/
-	if(full_name)
-		free(full_name);
-	if(cmd)
-		free(cmd);
+	
+	/*Free the verdicts and the path*/
+	free(verdicts);
+	free(fresh);
+	free(jobs);
+	free(path_to_node);
+	free(stats);
+	free(slots);
 	
 	/*Return the result of operations*/
 	return err;
@@ -626,9 +1544,8 @@ node_update
 		return err;
 		}
 		
-	/*Deallocate `node`'s port to the underlying filesystem*/
-	if(node->nn->port)
-		PORT_DEALLOC(node->nn->port);
+	/*Close `node`'s port to the underlying filesystem*/
+	node_port_set(node, MACH_PORT_NULL, 0);
 		
 	/*Try to lookup the file for `node` in its untranslated version*/
 	err = file_lookup
@@ -638,8 +1555,8 @@ node_update
 		);
 	if(err)
 		{
-		node->nn->port = MACH_PORT_NULL;
 		err = 0; /*failure (?)*/
+		mutex_unlock(&netfs_root_node->lock);
 		return err;
 		}
 	
@@ -667,12 +1584,13 @@ node_update
 		port = MACH_PORT_NULL;
 		
 	/*Store the port in the node*/
-	node->nn->port = port;
+	node_port_set(node, port, O_READ);
 	
 	/*Remove the flag about the invalidity of the current node and set the
 		flag that the node is up-to-date*/
 	node->nn->flags &= ~FLAG_NODE_INVALIDATE;
 	node->nn->flags |= FLAG_NODE_ULFS_UPTODATE;
+	node->nn->generation = lnode_generation(node->nn->lnode);
 	
 	/*Release the lock on the root node of filterfs filesystem*/
 	mutex_unlock(&netfs_root_node->lock);
@@ -686,6 +1604,7 @@ error_t
 node_get_size
 	(
 	node_t * dir,
+	uid_t uid, /*the user on whose behalf the filter runs*/
 	OFFSET_T * off
 	)
 	{
@@ -724,7 +1643,7 @@ node_get_size
 		}/*bump_size*/
 		
 	/*Obtain the list of entries in the current directory*/
-	err = node_entries_get(dir, &dirent_list);
+	err = node_entries_get(dir, uid, FILTER_CLASS_LISTING, &dirent_list, 0);
 	if(err)
 		return err;
 	
@@ -756,14 +1675,193 @@ node_get_size
 		)
 		bump_size(dirent_current->dirent->d_name);
 		
-	/*Free the list of dirents*/
-	node_entries_free(dirent_list);
+	/*The list of dirents is kept in the node, it must not be freed*/
 	
 	/*Return the size*/
 	*off = size;
 	return 0;
 	}/*node_get_size*/
 /*----------------------------------------------------------------------------*/
+/*Stores `port`, opened with `flags`, as the port of `node` (which must be
+	locked), replacing the old one*/
+void
+node_port_set
+	(
+	node_t * node,
+	file_t port,
+	int flags
+	)
+	{
+	/*Close the old port, if there is one*/
+	if(node->nn->port != MACH_PORT_NULL)
+		{
+		pcache_port_remove(node);
+		PORT_DEALLOC(node->nn->port);
+		}
+	
+	/*Store the new port*/
+	node->nn->port = port;
+	
+	/*If there is a port now, remember how it was opened and register it*/
+	if(port != MACH_PORT_NULL)
+		{
+		node->nn->port_flags = flags;
+		pcache_port_add(node, 0);
+		}
+	}/*node_port_set*/
+/*----------------------------------------------------------------------------*/
+/*Opens a new port to the underlying file of `node` (which must be locked)
+	with `flags`*/
+error_t
+node_port_open
+	(
+	node_t * node,
+	int flags,
+	file_t * port	/*store the port here*/
+	)
+	{
+	/*The root node is opened along its path, like in node_init_root*/
+	if(NODE_IS_ROOT(node))
+		{
+		*port = file_name_lookup(node->nn->lnode->path, flags, 0);
+		return (*port == MACH_PORT_NULL) ? (errno) : (0);
+		}
+	
+	/*Any other file is looked up by its name in the underlying directory
+		pinned in its lnode: the full path might lead through the namespace
+		into filterfs itself (e.g. when it is set on the directory it filters)
+		or to another file, if a directory on the way has been renamed; the
+		node of the parent is not locked, since nodes are only locked from the
+		parent to the child*/
+	if(node->nn->lnode->dir_port == MACH_PORT_NULL)
+		return EBADF;
+	*port = file_name_lookup_under
+		(node->nn->lnode->dir_port, node->nn->lnode->name, flags, 0);
+	return (*port == MACH_PORT_NULL) ? (errno) : (0);
+	}/*node_port_open*/
+/*----------------------------------------------------------------------------*/
+/*Makes sure `node` (which must be locked) has an open port to the underlying
+	file, (re)opening it with `flags` if it has been closed or has been opened
+	without some of `flags`*/
+error_t
+node_port_ensure
+	(
+	node_t * node,
+	int flags
+	)
+	{
+	error_t err;
+	
+	/*The reopened port*/
+	file_t port;
+	
+	/*The attributes of the file behind the old and the new port*/
+	io_statbuf_t stat, stat_new;
+
+	/*If the port is open in the required mode, only mark it as recently
+		used*/
+	if
+		(
+		(node->nn->port != MACH_PORT_NULL)
+		&& ((flags & ~node->nn->port_flags & (O_READ | O_WRITE)) == 0)
+		)
+		{
+		pcache_port_add(node, 0);
+		return 0;
+		}
+	
+	/*If the port is open in a narrower mode (e.g. for reading only, while
+		writing is required now), open a new port in the union of both modes;
+		the old port stays in place if this fails*/
+	if(node->nn->port != MACH_PORT_NULL)
+		{
+		flags |= node->nn->port_flags;
+		
+		err = node_port_open(node, flags, &port);
+		if(err)
+			return err;
+		
+		/*the name might refer to another file by now, which must not replace
+			the file the node stands for*/
+		err = io_stat(node->nn->port, &stat);
+		if(!err)
+			err = io_stat(port, &stat_new);
+		if
+			(
+			!err
+			&& ((stat.st_ino != stat_new.st_ino)
+				|| (stat.st_fsid != stat_new.st_fsid))
+			)
+			err = ESTALE;
+		if(err)
+			{
+			PORT_DEALLOC(port);
+			return err;
+			}
+			
+		node_port_set(node, port, flags);
+		return 0;
+		}
+	
+	/*If the port used to be open, reopen it the same way (and in the mode
+		required now)*/
+	if(node->nn->port_flags)
+		flags |= node->nn->port_flags;
+	
+	/*Reopen the file by its name in the parent directory*/
+	err = node_port_open(node, flags, &port);
+	if(err)
+		return err;
+		
+	LOG_MSG("node_port_ensure: %s '%s'.",
+		(node->nn->port_flags) ? ("Reopened") : ("Opened"),
+		node->nn->lnode->name);
+	
+	/*Store the port and register it in the cache of ports*/
+	node->nn->port = port;
+	pcache_port_add(node, node->nn->port_flags != 0);
+	node->nn->port_flags = flags;
+	
+	/*Return success*/
+	return 0;
+	}/*node_port_ensure*/
+/*----------------------------------------------------------------------------*/
+/*Estimates the number of bytes occupied by `node` and the resources
+	attached to it*/
+size_t
+node_cost
+	(
+	node_t * node
+	)
+	{
+	/*The node and the netnode themselves*/
+	size_t cost = sizeof(node_t) + sizeof(netnode_t);
+	
+	/*The lnode is shared with the lnode tree, but the path is only
+		maintained for nodes*/
+	if(node->nn->lnode->path)
+		cost += strlen(node->nn->lnode->path) + 1;
+	
+	/*An open port costs kernel memory and a port name*/
+	if(node->nn->port != MACH_PORT_NULL)
+		cost += NODE_PORT_COST;
+		
+	/*The data fetched ahead (read without the lock, it is an estimate)*/
+	if(node->nn->ra)
+		cost += sizeof(struct readahead) + node->nn->ra->buf_charge;
+		
+	/*The write-behind buffer*/
+	if(node->nn->wb)
+		cost += sizeof(struct writeback) + node->nn->wb->size;
+		
+	/*The last listing of the directory and its verdicts*/
+	cost += node->nn->listing_size;
+	cost += node->nn->verdicts_count * sizeof(node_verdict_t);
+		
+	/*Return the estimate*/
+	return cost;
+	}/*node_cost*/
+/*----------------------------------------------------------------------------*/
 /*Remove the file called `name` under `dir`*/
 error_t
 node_unlink_file
@@ -780,8 +1878,8 @@ node_unlink_file
 	/*Stat information about the file which will be unlinked*/
 	io_statbuf_t stat;
 	
-	/*If port corresponding to `dir` is invalid*/
-	if(dir->nn->port == MACH_PORT_NULL)
+	/*If port corresponding to `dir` cannot be opened*/
+	if(node_port_ensure(dir, O_READ | O_DIRECTORY))
 		/*stop with an error*/
 		return ENOENT; /*FIXME: Is the return value indeed meaningful here?*/
 	
@@ -798,6 +1896,20 @@ node_unlink_file
 	if(err)
 		return err;
 	
+	/*The lnode corresponding to the unlinked file*/
+	lnode_t * lnode;
+	
+	/*If there is an lnode for the file, its cached attributes are wrong now*/
+	if(lnode_get(dir->nn->lnode, name, &lnode) == 0)
+		{
+		lnode_stat_invalidate(lnode);
+		lnode_ref_remove(lnode);
+		}
+		
+	/*The directory has changed, too: its new modification time must be
+		fetched, so that the verdicts on its entries are checked anew*/
+	lnode_stat_invalidate(dir->nn->lnode);
+	
 	return err;
 	}/*node_unlink_file*/
 /*----------------------------------------------------------------------------*/
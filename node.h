@@ -39,6 +39,11 @@
 /*Checks whether the give node is the root of the filterfs filesystem*/
 #define NODE_IS_ROOT(n) (((n)->nn->lnode->dir) ? (0) : (1))
 /*----------------------------------------------------------------------------*/
+/*The memory taken by an element of a listing, including the lnode it keeps*/
+#define NODE_DIRENT_SIZE(d)\
+	(sizeof(node_dirent_t) + (d)->dirent->d_reclen\
+	+ (((d)->lnode) ? (sizeof(lnode_t)) : (0)))
+/*----------------------------------------------------------------------------*/
 /*Node flags*/
 #define FLAG_NODE_ULFS_FIXED 		0x00000001	/*this node should not be updated*/
 #define FLAG_NODE_INVALIDATE		0x00000002 	/*this node must be updated*/
@@ -51,9 +56,16 @@
 #	define OFFSET_T __off_t
 #endif /*__USE_FILE_OFFSET64*/
 /*----------------------------------------------------------------------------*/
-/*The size of a chunk of a string (for a small optimization in checking
-	the property)*/
-#define STRING_CHUNK 256
+/*The approximate cost (in bytes of kernel and translator memory) of keeping
+	a port to the underlying filesystem open*/
+#define NODE_PORT_COST 512
+/*----------------------------------------------------------------------------*/
+/*Whether listing a directory also fetches the attributes of the accepted
+	entries by default*/
+#define NODE_READDIR_PLUS 0
+/*----------------------------------------------------------------------------*/
+/*The maximal number of entries whose attributes one listing fetches*/
+#define NODE_PREFILL_MAX 128
 /*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
@@ -65,12 +77,76 @@ struct netnode
 	
 	/*the flags associated with this node (might be not required)*/
 	int flags;
+	
+	/*the generation of the cache (see lnode_generation) in which the node was
+		last updated from the underlying filesystem; FLAG_NODE_ULFS_UPTODATE
+		only holds in that generation*/
+	unsigned long generation;
 
-	/*a port to the underlying filesystem*/
+	/*a port to the underlying filesystem (may be closed by the cache of ports
+		at any moment the node is not locked; see node_port_ensure)*/
 	file_t port;
 	
+	/*the flags with which `port` was last opened (0 if it never was)*/
+	int port_flags;
+	
+	/*the neighbouring entries in the cache of ports and a flag telling
+		whether the node is registered in it*/
+	node_t * pcache_prev, * pcache_next;
+	int pcache_in;
+	
 	/*the neighbouring entries in the cache*/
 	node_t * ncache_prev, * ncache_next;
+	
+	/*the cache chain this node is linked into (see NCACHE_LIST_* in ncache.h)*/
+	int ncache_list;
+	
+	/*the cost of this node as it was charged to the cache*/
+	size_t ncache_cost;
+	
+	/*the read-ahead state of the file (created on the first read)*/
+	struct readahead * ra;
+	
+	/*the write-behind state of the file (created on the first buffered
+		write)*/
+	struct writeback * wb;
+	
+	/*the filtered list of entries of the directory obtained by the last
+		listing, its validity token (the modification time of the directory
+		and the epoch of the property) and the memory it occupies*/
+	struct node_dirent * listing;
+	struct timespec listing_dir_mtime;
+	unsigned long listing_epoch;
+	size_t listing_size;
+	
+	/*the generation of the listing: bumped whenever the listing is dropped
+		(and so before it is built anew), but not when single entries are
+		edited in it*/
+	unsigned long listing_generation;
+	
+	/*the verdicts on all entries found by the last listing, sorted by the
+		identity of the entry, their number and the epoch of the property
+		they were obtained under; when the directory changes, the entries
+		which are still there keep their verdicts*/
+	struct node_verdict * verdicts;
+	size_t verdicts_count;
+	unsigned long verdicts_epoch;
+	
+	/*the evaluations of the filter in progress in this directory, which
+		other threads may wait for instead of running the filter themselves,
+		and the condition signalled when one of them completes*/
+	struct node_flight * flights;
+	struct condition flights_done;
+	
+	/*the clients of filterfs asking to be notified of the changes of the
+		filtered view of this directory, and the number of the last change
+		notified to them (see notify.{c,h})*/
+	struct notify_client * clients;
+	natural_t clients_tick;
+	
+	/*the port the changes of the underlying directory are notified on, if
+		they are watched (see notify.{c,h})*/
+	struct notify * notify;
 	};/*struct netnode*/
 /*----------------------------------------------------------------------------*/
 typedef struct netnode netnode_t;
@@ -81,18 +157,64 @@ struct node_dirent
 	/*the directory entry*/
 	struct dirent * dirent;
 	
+	/*the lnode of the entry, if the listing has recorded something about it
+		(the listing holds a reference to it, so that the recorded verdict and
+		attributes live as long as the listing)*/
+	lnode_t * lnode;
+	
 	/*the next element*/
 	struct node_dirent * next;
 	};/*struct node_dirent*/
 /*----------------------------------------------------------------------------*/
 typedef struct node_dirent node_dirent_t;
 /*----------------------------------------------------------------------------*/
+/*The verdict on an entry found by a listing; the entry is identified by its
+	inode number and the hash of its name, since the filter may depend on
+	both*/
+struct node_verdict
+	{
+	ino_t ino;
+	unsigned long hash;
+	int good;
+	};/*struct node_verdict*/
+/*----------------------------------------------------------------------------*/
+typedef struct node_verdict node_verdict_t;
+/*----------------------------------------------------------------------------*/
+/*An evaluation of the filter in progress (a flight): the thread which has
+	started it (the leader) runs the filter without holding the lock of the
+	directory, while the threads asking for the same thing (the followers)
+	wait for its result. All fields are protected by the lock of the
+	directory.*/
+struct node_flight
+	{
+	/*the name of the entry being checked (NULL for a listing)*/
+	char * name;
+	
+	/*nonzero when the flight has completed; the verdict on the entry and
+		the error which has occurred*/
+	int done;
+	int good;
+	error_t err;
+	
+	/*the number of threads (the leader and the followers) using the flight*/
+	int refs;
+	
+	/*the next flight in the same directory*/
+	struct node_flight * next;
+	};/*struct node_flight*/
+/*----------------------------------------------------------------------------*/
+typedef struct node_flight node_flight_t;
+/*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Global Variables----------------------------------------------------*/
 /*The lock protecting the underlying filesystem*/
 extern struct mutex ulfs_lock;
 /*----------------------------------------------------------------------------*/
+/*Nonzero if listing a directory also fetches the attributes of the accepted
+	entries (may be overwritten by the user)*/
+extern int readdir_plus;
+/*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
 /*--------Functions-----------------------------------------------------------*/
@@ -133,12 +255,131 @@ node_entries_free
 	node_dirent_t * dirents	/*free this*/
 	);
 /*----------------------------------------------------------------------------*/
-/*Reads the directory entries from `node`, which must be locked*/
+/*Obtains the modification time of the directory `dir` (which must be
+	locked), from the cached attributes if possible; together with the epoch
+	of the property, it tells whether a recorded verdict may be trusted*/
+error_t
+node_dir_mtime_get
+	(
+	node_t * dir,
+	struct timespec * mtime
+	);
+/*----------------------------------------------------------------------------*/
+/*Finds the flight evaluating `name` (or listing, if `name` is NULL) in
+	`dir` (which must be locked) and joins it; returns NULL if there is no
+	such flight*/
+node_flight_t *
+node_flight_find
+	(
+	node_t * dir,
+	const char * name
+	);
+/*----------------------------------------------------------------------------*/
+/*Starts a flight evaluating `name` (or listing, if `name` is NULL) in `dir`
+	(which must be locked); returns NULL if there is not enough memory, in
+	which case the evaluation simply goes on without coalescing*/
+node_flight_t *
+node_flight_start
+	(
+	node_t * dir,
+	const char * name
+	);
+/*----------------------------------------------------------------------------*/
+/*Waits until `flight` in `dir` (which must be locked; the lock is released
+	while waiting) completes*/
+void
+node_flight_wait
+	(
+	node_t * dir,
+	node_flight_t * flight
+	);
+/*----------------------------------------------------------------------------*/
+/*Completes `flight` in `dir` (which must be locked) with the given result,
+	wakes up the followers and leaves the flight*/
+void
+node_flight_land
+	(
+	node_t * dir,
+	node_flight_t * flight,
+	int good,
+	error_t err
+	);
+/*----------------------------------------------------------------------------*/
+/*Leaves `flight`, freeing it if nobody else uses it (the directory must be
+	locked)*/
+void
+node_flight_release
+	(
+	node_flight_t * flight
+	);
+/*----------------------------------------------------------------------------*/
+/*Drops the list of entries kept in `node` (which must be locked)*/
+void
+node_listing_drop
+	(
+	node_t * node
+	);
+/*----------------------------------------------------------------------------*/
+/*Returns the verdict on the entry `name` of `dir` (which must be locked)
+	recorded by the listing of `dir`, if the listing is still valid for the
+	modification time `dir_mtime` and the epoch `epoch`; returns
+	LNODE_VERDICT_UNKNOWN otherwise*/
+int
+node_verdict_lookup
+	(
+	node_t * dir,
+	const char * name,
+	struct timespec dir_mtime,
+	unsigned long epoch
+	);
+/*----------------------------------------------------------------------------*/
+/*Forgets everything known about the entry `name` of `dir` (which must be
+	locked), which has been removed from the underlying directory; returns
+	nonzero if the entry was in the filtered view of the directory*/
+int
+node_entry_removed
+	(
+	node_t * dir,
+	const char * name
+	);
+/*----------------------------------------------------------------------------*/
+/*Evaluates the new entry `name` of `dir` (which must be locked; the lock is
+	released while the filter runs) and adds it to the listing and the
+	verdicts kept in `dir`; sets `good` to nonzero if the entry is accepted*/
+error_t
+node_entry_added
+	(
+	node_t * dir,
+	const char * name,
+	int * good
+	);
+/*----------------------------------------------------------------------------*/
+/*Makes the listing kept in `dir` (which must be locked) valid for the
+	current state of the directory, after the changes of the directory have
+	been applied to it; drops the listing if that cannot be done*/
+void
+node_listing_restamp
+	(
+	node_t * dir
+	);
+/*----------------------------------------------------------------------------*/
+/*Reads the directory entries from `node`, which must be locked. The verdict
+	on each entry is recorded in the lnode of the entry (lnodes are created
+	for the accepted entries), so that lookups and later listings need not
+	run the filter again while the directory does not change. The filter is
+	run without holding the lock of `node`; concurrent listings of the same
+	directory wait for the one in progress and share its result. The list is
+	kept in `node` while it is valid and must not be freed by the caller. If
+	`prefill` is nonzero and readdir_plus is set, the attributes of the
+	accepted entries are cached in their lnodes, too*/
 error_t
 node_entries_get
 	(
 	node_t * node,
-	node_dirent_t ** dirents /*store the result here*/
+	uid_t uid, /*the user on whose behalf the filter runs*/
+	int klass, /*the class of the filter work (see filter.h)*/
+	node_dirent_t ** dirents, /*store the result here*/
+	int prefill
 	);
 /*----------------------------------------------------------------------------*/
 /*Makes sure that all ports to the underlying filesystem of `node` are up to
@@ -154,9 +395,48 @@ error_t
 node_get_size
 	(
 	node_t * dir,
+	uid_t uid, /*the user on whose behalf the filter runs*/
 	OFFSET_T * off
 	);
 /*----------------------------------------------------------------------------*/
+/*Stores `port`, opened with `flags`, as the port of `node` (which must be
+	locked), replacing the old one*/
+void
+node_port_set
+	(
+	node_t * node,
+	file_t port,
+	int flags
+	);
+/*----------------------------------------------------------------------------*/
+/*Opens a new port to the underlying file of `node` (which must be locked)
+	with `flags`*/
+error_t
+node_port_open
+	(
+	node_t * node,
+	int flags,
+	file_t * port	/*store the port here*/
+	);
+/*----------------------------------------------------------------------------*/
+/*Makes sure `node` (which must be locked) has an open port to the underlying
+	file, (re)opening it with `flags` if it has been closed or has been opened
+	without some of `flags`*/
+error_t
+node_port_ensure
+	(
+	node_t * node,
+	int flags
+	);
+/*----------------------------------------------------------------------------*/
+/*Estimates the number of bytes occupied by `node` and the resources
+	attached to it*/
+size_t
+node_cost
+	(
+	node_t * node
+	);
+/*----------------------------------------------------------------------------*/
 /*Remove the file called `name` under `dir`*/
 error_t
 node_unlink_file
@@ -0,0 +1,433 @@
+/*----------------------------------------------------------------------------*/
+/*notify.c*/
+/*----------------------------------------------------------------------------*/
+/*The implementation of the incremental invalidation driven by change
+	notifications*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*----------------------------------------------------------------------------*/
+#include <hurd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+/*----------------------------------------------------------------------------*/
+#include "notify.h"
+#include "fs_notify_S.h"
+#include "ourfs_notify_U.h"
+#include "lib.h"
+#include "debug.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*Whether the changes of the underlying directories are watched (may be
+	overwritten by the user)*/
+int notify_enabled = NOTIFY;
+/*----------------------------------------------------------------------------*/
+/*The class and the bucket of the notification ports*/
+static struct port_class * notify_class;
+static struct port_bucket * notify_bucket;
+/*----------------------------------------------------------------------------*/
+/*The ports of the destroyed nodes waiting to be destroyed, the lock
+	protecting them and the condition signalled when one is added*/
+static notify_t * notify_orphans;
+static struct mutex notify_orphans_lock = MUTEX_INITIALIZER;
+static struct condition notify_orphaned;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Called when a notification port goes away (the subscription has been ended
+	by filterfs or the underlying filesystem): the directory is not watched
+	any more and its lnode is released*/
+static
+void
+notify_clean
+	(
+	void * arg
+	)
+	{
+	notify_t * nt = arg;
+	
+	mutex_lock(&nt->lnode->cache_lock);
+	nt->lnode->flags &= ~FLAG_LNODE_WATCHED;
+	mutex_unlock(&nt->lnode->cache_lock);
+	
+	mutex_lock(&nt->lnode->lock);
+	lnode_ref_remove(nt->lnode);
+	}/*notify_clean*/
+/*----------------------------------------------------------------------------*/
+/*Dispatches the messages arriving on the notification ports*/
+static
+int
+notify_demuxer
+	(
+	mach_msg_header_t * inp,
+	mach_msg_header_t * outp
+	)
+	{
+	return fs_notify_server(inp, outp) || ports_notify_server(inp, outp);
+	}/*notify_demuxer*/
+/*----------------------------------------------------------------------------*/
+/*Receives the change notifications; a single thread applies them, in the
+	order they were sent*/
+static
+any_t
+notify_thread
+	(
+	any_t arg
+	)
+	{
+	for(;;)
+		ports_manage_port_operations_one_thread(notify_bucket, notify_demuxer, 0);
+		
+	return 0;
+	}/*notify_thread*/
+/*----------------------------------------------------------------------------*/
+/*Destroys the ports of the destroyed nodes; runs in a thread of its own,
+	since the nodes are destroyed in a context which must not block*/
+static
+any_t
+notify_reaper
+	(
+	any_t arg
+	)
+	{
+	/*The port to destroy*/
+	notify_t * nt;
+	
+	for(;;)
+		{
+		mutex_lock(&notify_orphans_lock);
+		while(!notify_orphans)
+			condition_wait(&notify_orphaned, &notify_orphans_lock);
+		nt = notify_orphans;
+		notify_orphans = nt->next;
+		mutex_unlock(&notify_orphans_lock);
+		
+		/*The underlying filesystem finds the port dead and forgets it; the
+			lnode is released once the notifications in progress are done with
+			it*/
+		ports_destroy_right(nt);
+		ports_port_deref(nt);
+		}
+		
+	return 0;
+	}/*notify_reaper*/
+/*----------------------------------------------------------------------------*/
+/*Starts the thread receiving the change notifications*/
+error_t
+notify_init(void)
+	{
+	/*Create the class and the bucket of the notification ports*/
+	notify_class = ports_create_class(notify_clean, NULL);
+	notify_bucket = ports_create_bucket();
+	if(!notify_class || !notify_bucket)
+		return ENOMEM;
+	
+	condition_init(&notify_orphaned);
+	cthread_detach(cthread_fork(notify_thread, NULL));
+	cthread_detach(cthread_fork(notify_reaper, NULL));
+	return 0;
+	}/*notify_init*/
+/*----------------------------------------------------------------------------*/
+/*Asks the underlying directory of `dir` (which must be locked and have an
+	open port) to notify its changes, unless it is being asked already; the
+	changes are then applied to the listing, the verdicts and the lnodes of
+	`dir` one by one, so the listing stays valid while the directory
+	changes*/
+void
+notify_watch
+	(
+	node_t * dir
+	)
+	{
+	error_t err;
+	
+	/*The lnode of the directory*/
+	lnode_t * lnode = dir->nn->lnode;
+	
+	/*The new notification port*/
+	notify_t * nt;
+	
+	/*The attributes of the directory once it is watched*/
+	io_statbuf_t stat;
+	
+	/*Whether the directory is being watched already*/
+	int watched;
+	
+	/*The directories with clients are watched in any case*/
+	if(!notify_enabled && !dir->nn->clients)
+		return;
+	
+	/*Watch each directory once; a directory which cannot be watched is not
+		asked again*/
+	mutex_lock(&lnode->cache_lock);
+	watched = lnode->flags & FLAG_LNODE_WATCHED;
+	lnode->flags |= FLAG_LNODE_WATCHED;
+	mutex_unlock(&lnode->cache_lock);
+	if(watched)
+		return;
+	
+	/*Create the port the changes will be sent to*/
+	err = ports_create_port
+		(notify_class, notify_bucket, sizeof(notify_t), &nt);
+	if(err)
+		return;
+	mutex_lock(&lnode->lock);
+	lnode_ref_add(lnode);
+	mutex_unlock(&lnode->lock);
+	nt->lnode = lnode;
+	
+	/*Subscribe; the underlying filesystem holds the only send right, while
+		the node keeps the port until it is destroyed*/
+	err = dir_notice_changes(dir->nn->port, ports_get_send_right(nt));
+	if(err)
+		{
+		LOG_MSG("notify_watch: Cannot watch %s.", lnode->path);
+		ports_destroy_right(nt);
+		ports_port_deref(nt);
+		return;
+		}
+	dir->nn->notify = nt;
+		
+	/*The changes made between the listing and the subscription have not been
+		notified; if there have been any, the listing (which the caller may
+		still be reading) must not be trusted by the next one (no directory has
+		such a modification time)*/
+	if
+		(
+		dir->nn->listing
+		&& ((io_stat(dir->nn->port, &stat) != 0)
+			|| !TIMESPEC_EQUAL(stat.st_mtim, dir->nn->listing_dir_mtime))
+		)
+		dir->nn->listing_dir_mtime.tv_nsec = -1;
+	}/*notify_watch*/
+/*----------------------------------------------------------------------------*/
+/*Ends the subscription of `dir` to the changes of its underlying directory,
+	if there is one (called when the node is destroyed, so the port is only
+	handed over to a thread of its own, which destroys it)*/
+void
+notify_unwatch
+	(
+	node_t * dir
+	)
+	{
+	/*Queue the port for the reaper*/
+	if(dir->nn->notify)
+		{
+		mutex_lock(&notify_orphans_lock);
+		dir->nn->notify->next = notify_orphans;
+		notify_orphans = dir->nn->notify;
+		condition_signal(&notify_orphaned);
+		mutex_unlock(&notify_orphans_lock);
+		
+		dir->nn->notify = NULL;
+		}
+	}/*notify_unwatch*/
+/*----------------------------------------------------------------------------*/
+/*Sends the change of the filtered view of `dir` (which must be locked) to the
+	clients watching it, forgetting the clients which are gone*/
+static
+void
+notify_forward
+	(
+	node_t * dir,
+	dir_changed_type_t change,
+	const char * name
+	)
+	{
+	/*The link to the current client and the client*/
+	notify_client_t ** link, * client;
+	
+	++dir->nn->clients_tick;
+	for(link = &dir->nn->clients; *link;)
+		{
+		client = *link;
+		if
+			(
+			nowait_dir_changed
+				(client->port, dir->nn->clients_tick, change, (char *)name) == 0
+			)
+			link = &client->next;
+		else
+			{
+			/*the client cannot receive notifications any more*/
+			*link = client->next;
+			PORT_DEALLOC(client->port);
+			free(client);
+			}
+		}
+	}/*notify_forward*/
+/*----------------------------------------------------------------------------*/
+/*Sends the changes of the filtered view of `dir` (which must be locked) to
+	`port` from now on; only the entries entering or leaving the view are
+	notified (the first client of a directory keeps its node alive until the
+	last one goes away)*/
+error_t
+notify_client_add
+	(
+	node_t * dir,
+	mach_port_t port
+	)
+	{
+	error_t err;
+	
+	/*The new client*/
+	notify_client_t * client;
+	
+	/*Tell the client at once that it is being notified, like the other
+		filesystems do*/
+	err = nowait_dir_changed(port, dir->nn->clients_tick, DIR_CHANGED_NULL, "");
+	if(err)
+		return err;
+		
+	client = malloc(sizeof(notify_client_t));
+	if(!client)
+		return ENOMEM;
+	client->port = port;
+	
+	/*The node must live as long as it has clients*/
+	if(!dir->nn->clients)
+		netfs_nref(dir);
+	client->next = dir->nn->clients;
+	dir->nn->clients = client;
+	
+	/*The changes come from the underlying directory*/
+	if(node_port_ensure(dir, O_READ | O_DIRECTORY) == 0)
+		notify_watch(dir);
+		
+	return 0;
+	}/*notify_client_add*/
+/*----------------------------------------------------------------------------*/
+/*Applies the change of the entry `name` notified on `notify_port` to the
+	directory and forwards it to the clients watching the directory, as the
+	change of the filtered view it amounts to*/
+kern_return_t
+S_dir_changed
+	(
+	mach_port_t notify_port,
+	natural_t tickno,
+	dir_changed_type_t change,
+	string_t name
+	)
+	{
+	error_t err;
+	
+	/*The notification port and the directory*/
+	notify_t * nt;
+	node_t * dir;
+	
+	/*Whether the entry was in the filtered view and whether it is now*/
+	int shown, good = 0;
+	
+	/*Whether the directory had clients before the change was forwarded and
+		whether it has any after that*/
+	int watched, released;
+	
+	nt = ports_lookup_port(notify_bucket, notify_port, notify_class);
+	if(!nt)
+		return EOPNOTSUPP;
+		
+	/*Only a directory which has a node has anything cached to update (the
+		verdicts kept in lnodes are stale anyway once the directory changes)*/
+	mutex_lock(&nt->lnode->lock);
+	dir = nt->lnode->node;
+	if(dir)
+		netfs_nref(dir);
+	mutex_unlock(&nt->lnode->lock);
+	
+	if(dir)
+		{
+		mutex_lock(&dir->lock);
+		watched = dir->nn->clients != NULL;
+		
+		switch(change)
+			{
+			case DIR_CHANGED_NULL:
+				{
+				/*the subscription has been accepted, nothing has changed*/
+				break;
+				}
+			case DIR_CHANGED_UNLINK:
+			case DIR_CHANGED_NEW:
+			case DIR_CHANGED_RENUMBER:
+				{
+				/*forget the entry; if it is new or refers to another file now,
+					only this entry is given to the filter*/
+				shown = node_entry_removed(dir, name);
+				err = 0;
+				if(change != DIR_CHANGED_UNLINK)
+					err = node_entry_added(dir, name, &good);
+				if(err)
+					node_listing_drop(dir);
+				else
+					node_listing_restamp(dir);
+					
+				/*the clients see the entry appear or disappear*/
+				if(shown && !good)
+					notify_forward(dir, DIR_CHANGED_UNLINK, name);
+				else if(!shown && good)
+					notify_forward(dir, DIR_CHANGED_NEW, name);
+				else if(shown && good)
+					notify_forward(dir, change, name);
+					
+				break;
+				}
+			default:
+				{
+				/*an unknown change, nothing cached about the directory can be
+					trusted*/
+				lnode_invalidate(dir->nn->lnode);
+				
+				break;
+				}
+			}
+		
+		/*The reference held by the clients goes away with the last of them,
+			once the node is unlocked*/
+		released = watched && !dir->nn->clients;
+		netfs_nput(dir);
+		if(released)
+			netfs_nrele(dir);
+		}
+	
+	ports_port_deref(nt);
+	return 0;
+	}/*S_dir_changed*/
+/*----------------------------------------------------------------------------*/
+/*Changes of files are not watched*/
+kern_return_t
+S_file_changed
+	(
+	mach_port_t notify_port,
+	natural_t tickno,
+	file_changed_type_t change,
+	loff_t start,
+	loff_t end
+	)
+	{
+	return EOPNOTSUPP;
+	}/*S_file_changed*/
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,119 @@
+/*----------------------------------------------------------------------------*/
+/*notify.h*/
+/*----------------------------------------------------------------------------*/
+/*Incremental invalidation driven by change notifications*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+#ifndef __NOTIFY_H__
+#define __NOTIFY_H__
+
+/*----------------------------------------------------------------------------*/
+#include <error.h>
+#include <hurd/netfs.h>
+#include <hurd/ports.h>
+/*----------------------------------------------------------------------------*/
+#include "node.h"
+#include "lnode.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*Whether the changes of the underlying directories are watched by default*/
+#define NOTIFY 0
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Types---------------------------------------------------------------*/
+/*The port on which the changes of an underlying directory are notified*/
+struct notify
+	{
+	/*the port itself*/
+	struct port_info pi;
+	
+	/*the lnode of the directory (the port holds a reference to it)*/
+	lnode_t * lnode;
+	
+	/*the next port waiting to be destroyed, once its node is gone*/
+	struct notify * next;
+	};/*struct notify*/
+/*----------------------------------------------------------------------------*/
+typedef struct notify notify_t;
+/*----------------------------------------------------------------------------*/
+/*A client of filterfs notified of the changes of the filtered view of a
+	directory*/
+struct notify_client
+	{
+	/*the port the changes are sent to*/
+	mach_port_t port;
+	
+	/*the next client watching the same directory*/
+	struct notify_client * next;
+	};/*struct notify_client*/
+/*----------------------------------------------------------------------------*/
+typedef struct notify_client notify_client_t;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*Whether the changes of the underlying directories are watched (may be
+	overwritten by the user)*/
+extern int notify_enabled;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Starts the thread receiving the change notifications*/
+error_t
+notify_init(void);
+/*----------------------------------------------------------------------------*/
+/*Asks the underlying directory of `dir` (which must be locked and have an
+	open port) to notify its changes, unless it is being asked already; the
+	changes are then applied to the listing, the verdicts and the lnodes of
+	`dir` one by one, so the listing stays valid while the directory
+	changes*/
+void
+notify_watch
+	(
+	node_t * dir
+	);
+/*----------------------------------------------------------------------------*/
+/*Ends the subscription of `dir` to the changes of its underlying directory,
+	if there is one (called when the node is destroyed, so the port is only
+	handed over to a thread of its own, which destroys it)*/
+void
+notify_unwatch
+	(
+	node_t * dir
+	);
+/*----------------------------------------------------------------------------*/
+/*Sends the changes of the filtered view of `dir` (which must be locked) to
+	`port` from now on; only the entries entering or leaving the view are
+	notified (the first client of a directory keeps its node alive until the
+	last one goes away)*/
+error_t
+notify_client_add
+	(
+	node_t * dir,
+	mach_port_t port
+	);
+/*----------------------------------------------------------------------------*/
+#endif /*__NOTIFY_H__*/
@@ -28,12 +28,19 @@
 #define _GNU_SOURCE 1
 /*----------------------------------------------------------------------------*/
 #include <argp.h>
+#include <argz.h>
 #include <error.h>
+#include <stdarg.h>
+#include <stdio.h>
 /*----------------------------------------------------------------------------*/
 #include "debug.h"
 #include "options.h"
 #include "ncache.h"
+#include "pcache.h"
+#include "bcache.h"
 #include "node.h"
+#include "filter.h"
+#include "refresh.h"
 /*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
@@ -80,14 +87,96 @@ static int parsing_startup_options_finished;
 static const struct argp_option argp_common_options[] =
 	{
 	{OPT_LONG_CACHE_SIZE, OPT_CACHE_SIZE, "SIZE", 0,
-		"The maximal number of nodes in the node cache"},
+		"The maximal number of nodes in the node cache (the cache is split into"
+		" 16 shards of at least one node each, so values between 1 and 16 are"
+		" rounded up to 16; 0 disables the cache)"},
+	{OPT_LONG_CACHE_BYTES, OPT_CACHE_BYTES, "BYTES", 0,
+		"The approximate memory budget of the node cache (suffixes K, M and G"
+		" are understood; 0 means no budget)"},
+	{OPT_LONG_CACHE_WATERMARK, OPT_CACHE_WATERMARK, "BYTES", 0,
+		"Shrink the node cache while the translator uses more memory than this"
+		" (0 means never)"},
+	{OPT_LONG_ATTR_TIMEOUT, OPT_ATTR_TIMEOUT, "SECS", 0,
+		"The time during which cached attributes of files are valid (0 disables"
+		" the attribute cache)"},
+	{OPT_LONG_PORT_CACHE_SIZE, OPT_PORT_CACHE_SIZE, "SIZE", 0,
+		"The maximal number of ports to the underlying filesystem kept open"
+		" (0 means no limit)"},
+	{OPT_LONG_ZERO_COPY_MIN, OPT_ZERO_COPY_MIN, "BYTES", 0,
+		"Hand reads of at least this size to the client in the memory sent by"
+		" the underlying filesystem, without copying (0 disables this)"},
+	{OPT_LONG_READAHEAD_BUDGET, OPT_READAHEAD_BUDGET, "BYTES", 0,
+		"The memory all read-ahead buffers may occupy together (0 disables"
+		" read-ahead)"},
+	{OPT_LONG_BLOCK_CACHE_SIZE, OPT_BLOCK_CACHE_SIZE, "BYTES", 0,
+		"The memory in which blocks of small files are cached (0 disables the"
+		" block cache)"},
+	{OPT_LONG_WRITE_BEHIND, OPT_WRITE_BEHIND, "BYTES", 0,
+		"Coalesce sequential writes smaller than this into writes of this size"
+		" (0 means write every piece through at once)"},
+	{OPT_LONG_WRITE_BEHIND_TIMEOUT, OPT_WRITE_BEHIND_TIMEOUT, "SECS", 0,
+		"The time coalesced data may wait before being written"},
+	{OPT_LONG_READDIR_PLUS, OPT_READDIR_PLUS, 0, 0,
+		"While listing a directory, fetch and cache the attributes of the"
+		" accepted entries, so that the lookups following the listing need"
+		" not run the filter again"},
+	{OPT_LONG_NO_READDIR_PLUS, OPT_NO_READDIR_PLUS, 0, 0,
+		"Do not fetch the attributes of the entries while listing (default)"},
+	{OPT_LONG_FILTER_JOBS, OPT_FILTER_JOBS, "JOBS", 0,
+		"The maximal number of filtering commands running at once (0 means no"
+		" limit)"},
+	{OPT_LONG_FILTER_JOBS_MIN, OPT_FILTER_JOBS_MIN, "JOBS", 0,
+		"The minimal number of filtering commands running at once; between the"
+		" two bounds the number follows the latency of the commands"},
+	{OPT_LONG_FILTER_LATENCY, OPT_FILTER_LATENCY, "MSECS", 0,
+		"Run fewer filtering commands at once when they take longer than this"
+		" (0 means twice as long as the fastest ones)"},
+	{OPT_LONG_FILTER_PRIORITY, OPT_FILTER_PRIORITY, "POLICY", 0,
+		"How lookups, listings and background work share the filtering"
+		" commands: `strict' (lookups always first) or `weighted' (default)"},
+	{OPT_LONG_FILTER_USER_JOBS, OPT_FILTER_USER_JOBS, "JOBS", 0,
+		"The maximal number of filtering commands running at once on behalf of"
+		" one user (0 means no limit); the users take turns in any case"},
+	{OPT_LONG_PREFETCH, OPT_PREFETCH, "DIRS", 0,
+		"After a directory is listed, evaluate the filter on the contents of at"
+		" most this many of its subdirectories in the background (0 disables"
+		" the prefetch)"},
+	{OPT_LONG_PREFETCH_DEPTH, OPT_PREFETCH_DEPTH, "LEVELS", 0,
+		"The number of levels of subdirectories prefetched"},
+	{OPT_LONG_REFRESH, OPT_REFRESH, "DIRS", 0,
+		"Keep the listings of at most this many often listed directories fresh"
+		" in the background (0 disables the refresh-ahead)"},
+	{OPT_LONG_REFRESH_IDLE, OPT_REFRESH_IDLE, "SECS", 0,
+		"Stop refreshing a directory nobody has listed for this long"},
+	{OPT_LONG_NOTIFY, OPT_NOTIFY, 0, 0,
+		"Ask the underlying directories to notify their changes and apply them"
+		" to the cached listings one entry at a time, instead of listing and"
+		" filtering the whole directory again"},
+	{OPT_LONG_NO_NOTIFY, OPT_NO_NOTIFY, 0, 0,
+		"Do not watch the directories listed from now on (default; the"
+		" directories watched already stay watched)"},
 	{OPT_LONG_PROPERTY, OPT_PROPERTY, "PROPERTY", 0,
-		"The command which will act as a filter"}
+		"The command which will act as a filter"},
+	{OPT_LONG_RULE, OPT_RULE, "PREFIX:PROPERTY", 0,
+		"Filter the subtree PREFIX (relative to DIR) with PROPERTY instead;"
+		" may be repeated, the deepest subtree wins (at runtime, the rules"
+		" given replace all rules; an empty one removes them)"},
+	{OPT_LONG_PRUNE, OPT_PRUNE, 0, 0,
+		"Let the subtree of a directory inherit its verdict: an accepted"
+		" directory shows everything below it unfiltered, so only the entries"
+		" of DIR and of the subtrees with rules are given to the filter"},
+	{OPT_LONG_NO_PRUNE, OPT_NO_PRUNE, 0, 0,
+		"Give every entry to the filter, whatever the verdict on its directory"
+		" (default)"},
+	{0}
 	};
 /*----------------------------------------------------------------------------*/
 /*Argp options only meaningful for startupp parsing*/
 static const struct argp_option argp_startup_options[] =
 	{
+	{OPT_LONG_CACHE_POLICY, OPT_CACHE_POLICY, "POLICY", 0,
+		"The replacement policy of the node cache: `lru' (default) or the"
+		" scan-resistant `2q'"},
 	{0}
 	};
 /*----------------------------------------------------------------------------*/
@@ -127,8 +216,20 @@ struct argp argp_runtime =
 struct argp argp_startup =
 	{0, 0, ARGS_DOC, DOC, argp_children_startup};
 /*----------------------------------------------------------------------------*/
-/*The filtering command*/
-char * property = NULL;
+/*The filtering command given in the options being parsed; it is handed over
+	to the filter executor once they have all been parsed*/
+static char * property = NULL;
+/*----------------------------------------------------------------------------*/
+/*The rules given in the options being parsed (an argz vector) and whether
+	any have been given; they are handed over to the filter executor once
+	the options have all been parsed*/
+static char * rules = NULL;
+static size_t rules_len = 0;
+static int rules_given;
+/*----------------------------------------------------------------------------*/
+/*Whether the inheritance of verdicts has been turned on (1) or off (0) in
+	the options being parsed (-1 if it has not been mentioned)*/
+static int prune = -1;
 /*----------------------------------------------------------------------------*/
 /*The directory to filter*/
 char * dir = NULL;
@@ -136,6 +237,61 @@ char * dir = NULL;
 
 /*----------------------------------------------------------------------------*/
 /*--------Functions-----------------------------------------------------------*/
+/*Parses a size in bytes, possibly followed by one of the suffixes K, M, G*/
+static
+size_t
+options_size_parse
+	(
+	char * arg
+	)
+	{
+	/*The end of the number*/
+	char * end;
+	
+	/*Parse the number itself*/
+	size_t size = strtoul(arg, &end, 10);
+	
+	/*Apply the suffix, if there is one*/
+	switch(*end)
+		{
+		case 'g': case 'G':
+			size *= 1024;
+		case 'm': case 'M':
+			size *= 1024;
+		case 'k': case 'K':
+			size *= 1024;
+		}
+		
+	/*Return the result*/
+	return size;
+	}/*options_size_parse*/
+/*----------------------------------------------------------------------------*/
+/*Hands the rules given in the options being parsed over to the filter
+	executor*/
+static
+error_t
+options_rules_install(void)
+	{
+	error_t err;
+	
+	/*The rules as an array of strings*/
+	int count = argz_count(rules, rules_len);
+	char ** vec = malloc((count + 1) * sizeof(char *));
+	if(!vec)
+		return ENOMEM;
+	argz_extract(rules, rules_len, vec);
+	
+	/*Install them and forget them*/
+	err = filter_rules_set(vec, count);
+	free(vec);
+	free(rules);
+	rules = NULL;
+	rules_len = 0;
+	rules_given = 0;
+	
+	return err;
+	}/*options_rules_install*/
+/*----------------------------------------------------------------------------*/
 /*Argp parser function for the common options*/
 static
 error_t
@@ -156,15 +312,207 @@ argp_parse_common_options
 			/*store the new cache-size*/
 			ncache_size = strtol(arg, NULL, 10);
 			
+			break;
+			}
+		case OPT_CACHE_BYTES:
+			{
+			/*store the new byte budget*/
+			ncache_bytes = options_size_parse(arg);
+			
+			break;
+			}
+		case OPT_CACHE_WATERMARK:
+			{
+			/*store the new memory watermark*/
+			ncache_watermark = options_size_parse(arg);
+			
+			break;
+			}
+		case OPT_ATTR_TIMEOUT:
+			{
+			/*store the new timeout of the attribute cache*/
+			lnode_attr_timeout = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_PORT_CACHE_SIZE:
+			{
+			/*store the new limit of open ports*/
+			pcache_size = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_ZERO_COPY_MIN:
+			{
+			/*store the new threshold of zero-copy reads*/
+			zero_copy_min = options_size_parse(arg);
+			
+			break;
+			}
+		case OPT_READAHEAD_BUDGET:
+			{
+			/*store the new budget of read-ahead*/
+			readahead_budget = options_size_parse(arg);
+			
+			break;
+			}
+		case OPT_BLOCK_CACHE_SIZE:
+			{
+			/*store the new capacity of the cache of blocks*/
+			bcache_size = options_size_parse(arg);
+			
+			break;
+			}
+		case OPT_WRITE_BEHIND:
+			{
+			/*store the new size of the write-behind buffers*/
+			writeback_size = options_size_parse(arg);
+			
+			break;
+			}
+		case OPT_WRITE_BEHIND_TIMEOUT:
+			{
+			/*store the new time buffered data may wait*/
+			writeback_timeout = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_READDIR_PLUS:
+			{
+			/*fetch the attributes of the entries from now on*/
+			readdir_plus = 1;
+			
+			break;
+			}
+		case OPT_NO_READDIR_PLUS:
+			{
+			/*list only the names of the entries from now on*/
+			readdir_plus = 0;
+			
+			break;
+			}
+		case OPT_FILTER_JOBS:
+			{
+			/*store the new maximal number of running filtering commands*/
+			filter_concurrency = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_FILTER_JOBS_MIN:
+			{
+			/*store the new minimal number of running filtering commands*/
+			filter_concurrency_min = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_FILTER_LATENCY:
+			{
+			/*store the new target latency of filtering commands*/
+			filter_target_latency = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_FILTER_PRIORITY:
+			{
+			/*see which scheduling is requested*/
+			if(strcmp(arg, "strict") == 0)
+				filter_priority = FILTER_PRIORITY_STRICT;
+			else if(strcmp(arg, "weighted") == 0)
+				filter_priority = FILTER_PRIORITY_WEIGHTED;
+			else
+				argp_error(state, "Unknown filter priority: %s", arg);
+				
+			break;
+			}
+		case OPT_FILTER_USER_JOBS:
+			{
+			/*store the new maximal number of running commands of one user*/
+			filter_user_concurrency = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_PREFETCH:
+			{
+			/*store the new number of subdirectories waiting to be prefetched*/
+			prefetch_budget = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_PREFETCH_DEPTH:
+			{
+			/*store the new number of levels prefetched*/
+			prefetch_depth = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_REFRESH:
+			{
+			/*store the new number of directories watched*/
+			refresh_size = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_REFRESH_IDLE:
+			{
+			/*store the new time after which unused directories are forgotten*/
+			refresh_idle = strtol(arg, NULL, 10);
+			
+			break;
+			}
+		case OPT_NOTIFY:
+			{
+			/*watch the directories listed from now on*/
+			notify_enabled = 1;
+			
+			break;
+			}
+		case OPT_NO_NOTIFY:
+			{
+			/*do not watch the directories listed from now on*/
+			notify_enabled = 0;
+			
 			break;
 			}
 		case OPT_PROPERTY:
 			{
 			/*try to duplicate the filtering command*/
+			free(property);
 			property = strdup(arg);
 			if(!property)
+				{
+				/*at runtime the old property simply stays in force*/
+				if(parsing_startup_options_finished)
+					return ENOMEM;
 				error(EXIT_FAILURE, ENOMEM, "Could not strdup the property");
+				}
 				
+			break;
+			}
+		case OPT_RULE:
+			{
+			/*remember the rule (an empty one just says the rules change)*/
+			rules_given = 1;
+			if(*arg && argz_add(&rules, &rules_len, arg))
+				{
+				if(parsing_startup_options_finished)
+					return ENOMEM;
+				error(EXIT_FAILURE, ENOMEM, "Could not store the rule");
+				}
+			
+			break;
+			}
+		case OPT_PRUNE:
+			{
+			/*the verdicts on directories will be inherited*/
+			prune = 1;
+			
+			break;
+			}
+		case OPT_NO_PRUNE:
+			{
+			/*the verdicts on directories will not be inherited*/
+			prune = 0;
+			
 			break;
 			}
 		case ARGP_KEY_ARG: /*the directory to filter*/
@@ -197,6 +545,29 @@ argp_parse_common_options
 				/*reset the cache*/
 				ncache_reset();
 				
+				/*install the property*/
+				if(property)
+					{
+					err = filter_property_set(property);
+					if(err)
+						error(EXIT_FAILURE, err, "Could not set the property");
+					free(property);
+					property = NULL;
+					}
+				
+				/*install the rules*/
+				if(rules_given)
+					{
+					err = options_rules_install();
+					if(err)
+						error(EXIT_FAILURE, err, "Could not set the rules");
+					}
+				
+				/*start or stop inheriting the verdicts on directories*/
+				if(prune >= 0)
+					filter_prune_set(prune);
+				prune = -1;
+				
 				/*If the directory has not been specified*/
 				if(!dir)
 					{
@@ -212,8 +583,37 @@ argp_parse_common_options
 				}
 			else
 				{
-/*TODO: Take care of runtime calls modifying the property*/
+				/*Whether the property, the rules or their inheritance are
+					changing*/
+				int changed = property || rules_given
+					|| ((prune >= 0) && (prune != filter_prune));
+				
+				/*apply the new limits of the cache, evicting whatever does not
+					fit into them*/
+				ncache_resize(ncache_size, ncache_bytes, ncache_watermark);
+				pcache_resize(pcache_size);
+				bcache_resize(bcache_size);
+				
+				/*If the property or the rules have been changed, swap them in;
+					the verdicts obtained under the old ones become stale, while
+					the cached attributes and ports stay, and the hot directories
+					are filtered anew in the background*/
+				if(property)
+					{
+					err = filter_property_set(property);
+					free(property);
+					property = NULL;
+					}
+				if(!err && rules_given)
+					err = options_rules_install();
+				if(prune >= 0)
+					filter_prune_set(prune);
+				prune = -1;
+				if(!err && changed)
+					refresh_all();
 				}
+				
+			break;
 			}
 		/*If the option could not be recognized*/
 		default:
@@ -237,11 +637,22 @@ argp_parse_startup_options
 	struct argp_state * state
 	)
 	{
-	/*Do nothing in a beautiful way*/
 	error_t err = 0;
 	
 	switch(key)
 		{
+		case OPT_CACHE_POLICY:
+			{
+			/*see which policy is requested*/
+			if(strcmp(arg, "lru") == 0)
+				ncache_policy = NCACHE_POLICY_LRU;
+			else if(strcmp(arg, "2q") == 0)
+				ncache_policy = NCACHE_POLICY_2Q;
+			else
+				argp_error(state, "Unknown cache policy: %s", arg);
+				
+			break;
+			}
 		default:
 			{
 			err = ARGP_ERR_UNKNOWN;
@@ -253,3 +664,106 @@ argp_parse_startup_options
 	return err;
 	}/*argp_parse_startup_options*/
 /*----------------------------------------------------------------------------*/
+/*Appends the current values of the options to `argz` (for fsysopts)*/
+error_t
+netfs_append_args
+	(
+	char ** argz,
+	size_t * argz_len
+	)
+	{
+	error_t err = 0;
+	
+	/*A buffer for a single option*/
+	char * buf;
+	
+	/*The copy of the property or of a rule*/
+	char * property_text;
+	int i;
+	
+	/*Adds a single option to `argz`*/
+	void
+	add_option
+		(
+		const char * fmt,
+		...
+		)
+		{
+		va_list ap;
+		
+		/*If an error has already occurred, do nothing*/
+		if(err)
+			return;
+		
+		/*Format the option*/
+		va_start(ap, fmt);
+		if(vasprintf(&buf, fmt, ap) < 0)
+			err = ENOMEM;
+		va_end(ap);
+		
+		/*Append the option to the list*/
+		if(!err)
+			{
+			err = argz_add(argz, argz_len, buf);
+			free(buf);
+			}
+		}/*add_option*/
+		
+	/*Add the standard options first*/
+	err = netfs_append_std_options(argz, argz_len);
+	
+	/*Add our options*/
+	add_option(OPT_LONG(OPT_LONG_CACHE_SIZE)"=%d", ncache_size);
+	add_option(OPT_LONG(OPT_LONG_CACHE_BYTES)"=%lu", (unsigned long)ncache_bytes);
+	add_option(OPT_LONG(OPT_LONG_CACHE_WATERMARK)"=%lu",
+		(unsigned long)ncache_watermark);
+	add_option(OPT_LONG(OPT_LONG_ATTR_TIMEOUT)"=%d", lnode_attr_timeout);
+	add_option(OPT_LONG(OPT_LONG_PORT_CACHE_SIZE)"=%d", pcache_size);
+	add_option(OPT_LONG(OPT_LONG_ZERO_COPY_MIN)"=%lu",
+		(unsigned long)zero_copy_min);
+	add_option(OPT_LONG(OPT_LONG_READAHEAD_BUDGET)"=%lu",
+		(unsigned long)readahead_budget);
+	add_option(OPT_LONG(OPT_LONG_BLOCK_CACHE_SIZE)"=%lu",
+		(unsigned long)bcache_size);
+	add_option(OPT_LONG(OPT_LONG_WRITE_BEHIND)"=%lu",
+		(unsigned long)writeback_size);
+	add_option(OPT_LONG(OPT_LONG_WRITE_BEHIND_TIMEOUT)"=%d", writeback_timeout);
+	if(readdir_plus)
+		add_option(OPT_LONG(OPT_LONG_READDIR_PLUS));
+	add_option(OPT_LONG(OPT_LONG_FILTER_JOBS)"=%d", filter_concurrency);
+	add_option(OPT_LONG(OPT_LONG_FILTER_JOBS_MIN)"=%d", filter_concurrency_min);
+	add_option(OPT_LONG(OPT_LONG_FILTER_LATENCY)"=%d", filter_target_latency);
+	add_option(OPT_LONG(OPT_LONG_FILTER_PRIORITY)"=%s",
+		(filter_priority == FILTER_PRIORITY_STRICT) ? "strict" : "weighted");
+	add_option(OPT_LONG(OPT_LONG_FILTER_USER_JOBS)"=%d",
+		filter_user_concurrency);
+	add_option(OPT_LONG(OPT_LONG_PREFETCH)"=%d", prefetch_budget);
+	add_option(OPT_LONG(OPT_LONG_PREFETCH_DEPTH)"=%d", prefetch_depth);
+	add_option(OPT_LONG(OPT_LONG_REFRESH)"=%d", refresh_size);
+	add_option(OPT_LONG(OPT_LONG_REFRESH_IDLE)"=%d", refresh_idle);
+	if(notify_enabled)
+		add_option(OPT_LONG(OPT_LONG_NOTIFY));
+	add_option(OPT_LONG(OPT_LONG_CACHE_POLICY)"=%s",
+		(ncache_policy == NCACHE_POLICY_2Q) ? "2q" : "lru");
+	property_text = filter_property_get();
+	if(property_text)
+		{
+		add_option(OPT_LONG(OPT_LONG_PROPERTY)"=%s", property_text);
+		free(property_text);
+		}
+	if(filter_prune)
+		add_option(OPT_LONG(OPT_LONG_PRUNE));
+	for(i = 0; (property_text = filter_rule_get(i)) != NULL; ++i)
+		{
+		add_option(OPT_LONG(OPT_LONG_RULE)"=%s", property_text);
+		free(property_text);
+		}
+	
+	/*Add the directory being filtered*/
+	if(!err && dir)
+		err = argz_add(argz, argz_len, dir);
+		
+	/*Return the result of operations*/
+	return err;
+	}/*netfs_append_args*/
+/*----------------------------------------------------------------------------*/
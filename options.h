@@ -32,10 +32,87 @@
 #define OPT_CACHE_SIZE 'c'
 /*the property according to which filtering will be performed*/
 #define OPT_PROPERTY	 'p'
+/*the replacement policy of the node cache*/
+#define OPT_CACHE_POLICY 'P'
+/*the byte budget of the node cache*/
+#define OPT_CACHE_BYTES 'b'
+/*the memory watermark above which the node cache shrinks*/
+#define OPT_CACHE_WATERMARK 'w'
+/*the time during which cached attributes are valid*/
+#define OPT_ATTR_TIMEOUT 'a'
+/*the maximal number of open ports to the underlying filesystem*/
+#define OPT_PORT_CACHE_SIZE 'o'
+/*the size of reads forwarded without copying*/
+#define OPT_ZERO_COPY_MIN 'z'
+/*the memory budget of read-ahead*/
+#define OPT_READAHEAD_BUDGET 'r'
+/*the capacity of the cache of blocks of small files*/
+#define OPT_BLOCK_CACHE_SIZE 'k'
+/*the size of the write-behind buffers*/
+#define OPT_WRITE_BEHIND 'W'
+/*the time buffered data may wait*/
+#define OPT_WRITE_BEHIND_TIMEOUT 'T'
+/*fetch the attributes of the entries while listing directories*/
+#define OPT_READDIR_PLUS 'l'
+/*the maximal number of filtering commands running at once*/
+#define OPT_FILTER_JOBS 'j'
+/*the minimal number of filtering commands running at once*/
+#define OPT_FILTER_JOBS_MIN 'J'
+/*the latency of a filtering command above which fewer commands run*/
+#define OPT_FILTER_LATENCY 'L'
+/*the way filter work of different classes is scheduled*/
+#define OPT_FILTER_PRIORITY 'S'
+/*the maximal number of filtering commands running at once for one user*/
+#define OPT_FILTER_USER_JOBS 'U'
+/*the maximal number of subdirectories waiting to be prefetched*/
+#define OPT_PREFETCH 'F'
+/*the number of levels of subdirectories prefetched*/
+#define OPT_PREFETCH_DEPTH 'D'
+/*the maximal number of directories watched for refresh-ahead*/
+#define OPT_REFRESH 'R'
+/*the time after which a directory nobody lists is not refreshed*/
+#define OPT_REFRESH_IDLE 'I'
+/*keep the listings up to date using the change notifications*/
+#define OPT_NOTIFY 'n'
+/*a property applying to a subtree instead of the default one*/
+#define OPT_RULE 'u'
+/*inherit the verdicts on directories in their subtrees*/
+#define OPT_PRUNE 'i'
+/*----------------------------------------------------------------------------*/
+/*The options turning the switches above off (they have no short form)*/
+#define OPT_NO_READDIR_PLUS 256
+#define OPT_NO_NOTIFY 257
+#define OPT_NO_PRUNE 258
 /*----------------------------------------------------------------------------*/
 /*The corresponding long options*/
 #define OPT_LONG_CACHE_SIZE "cache-size"
 #define OPT_LONG_PROPERTY 	"property"
+#define OPT_LONG_CACHE_POLICY "cache-policy"
+#define OPT_LONG_CACHE_BYTES "cache-bytes"
+#define OPT_LONG_CACHE_WATERMARK "cache-watermark"
+#define OPT_LONG_ATTR_TIMEOUT "attr-timeout"
+#define OPT_LONG_PORT_CACHE_SIZE "port-cache-size"
+#define OPT_LONG_ZERO_COPY_MIN "zero-copy-min"
+#define OPT_LONG_READAHEAD_BUDGET "readahead-budget"
+#define OPT_LONG_BLOCK_CACHE_SIZE "block-cache-size"
+#define OPT_LONG_WRITE_BEHIND "write-behind"
+#define OPT_LONG_WRITE_BEHIND_TIMEOUT "write-behind-timeout"
+#define OPT_LONG_READDIR_PLUS "readdir-plus"
+#define OPT_LONG_FILTER_JOBS "filter-jobs"
+#define OPT_LONG_FILTER_JOBS_MIN "filter-jobs-min"
+#define OPT_LONG_FILTER_LATENCY "filter-latency"
+#define OPT_LONG_FILTER_PRIORITY "filter-priority"
+#define OPT_LONG_FILTER_USER_JOBS "filter-user-jobs"
+#define OPT_LONG_PREFETCH "prefetch"
+#define OPT_LONG_PREFETCH_DEPTH "prefetch-depth"
+#define OPT_LONG_REFRESH "refresh-ahead"
+#define OPT_LONG_REFRESH_IDLE "refresh-idle"
+#define OPT_LONG_NOTIFY "notify"
+#define OPT_LONG_RULE "rule"
+#define OPT_LONG_PRUNE "prune"
+#define OPT_LONG_NO_READDIR_PLUS "no-readdir-plus"
+#define OPT_LONG_NO_NOTIFY "no-notify"
+#define OPT_LONG_NO_PRUNE "no-prune"
 /*----------------------------------------------------------------------------*/
 /*Makes a long option out of option name*/
 #define OPT_LONG(o) "--"o
@@ -55,8 +132,61 @@ extern struct argp argp_runtime;
 /*The number of nodes in cache (see ncache.{c,h})*/
 extern int ncache_size;
 /*----------------------------------------------------------------------------*/
-/*The filtering command*/
-extern char * property;
+/*The replacement policy of the cache (see ncache.{c,h})*/
+extern int ncache_policy;
+/*----------------------------------------------------------------------------*/
+/*The byte budget and the memory watermark of the cache (see ncache.{c,h})*/
+extern size_t ncache_bytes, ncache_watermark;
+/*----------------------------------------------------------------------------*/
+/*The time during which cached attributes are valid (see lnode.{c,h})*/
+extern int lnode_attr_timeout;
+/*----------------------------------------------------------------------------*/
+/*The maximal number of open ports (see pcache.{c,h})*/
+extern int pcache_size;
+/*----------------------------------------------------------------------------*/
+/*The size of reads forwarded without copying (see filterfs.{c,h})*/
+extern size_t zero_copy_min;
+/*----------------------------------------------------------------------------*/
+/*The memory budget of read-ahead (see readahead.{c,h})*/
+extern size_t readahead_budget;
+/*----------------------------------------------------------------------------*/
+/*The capacity of the cache of blocks (see bcache.{c,h})*/
+extern size_t bcache_size;
+/*----------------------------------------------------------------------------*/
+/*The size of the write-behind buffers and the time buffered data may wait
+	(see writeback.{c,h})*/
+extern size_t writeback_size;
+extern int writeback_timeout;
+/*----------------------------------------------------------------------------*/
+/*Whether listing fetches the attributes of the entries (see node.{c,h})*/
+extern int readdir_plus;
+/*----------------------------------------------------------------------------*/
+/*The bounds of the number of filtering commands running at once and the
+	target latency of a command (see filter.{c,h})*/
+extern int filter_concurrency;
+extern int filter_concurrency_min;
+extern int filter_target_latency;
+/*----------------------------------------------------------------------------*/
+/*The way filter work of different classes is scheduled (see filter.{c,h})*/
+extern int filter_priority;
+/*----------------------------------------------------------------------------*/
+/*The maximal number of filtering commands running at once for one user (see
+	filter.{c,h})*/
+extern int filter_user_concurrency;
+/*----------------------------------------------------------------------------*/
+/*The maximal number of subdirectories waiting to be prefetched and the
+	number of levels prefetched (see prefetch.{c,h})*/
+extern int prefetch_budget;
+extern int prefetch_depth;
+/*----------------------------------------------------------------------------*/
+/*The maximal number of directories watched for refresh-ahead and the time
+	after which an unused one is forgotten (see refresh.{c,h})*/
+extern int refresh_size;
+extern int refresh_idle;
+/*----------------------------------------------------------------------------*/
+/*Whether the changes of the underlying directories are watched (see
+	notify.{c,h})*/
+extern int notify_enabled;
 /*----------------------------------------------------------------------------*/
 /*The directory to filter*/
 extern char * dir;
@@ -0,0 +1,238 @@
+/*----------------------------------------------------------------------------*/
+/*pcache.c*/
+/*----------------------------------------------------------------------------*/
+/*The implementation of the cache of ports to the underlying filesystem*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*----------------------------------------------------------------------------*/
+#include "pcache.h"
+#include "lib.h"
+#include "debug.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The global cache of ports*/
+pcache_t pcache;
+/*----------------------------------------------------------------------------*/
+/*The maximal number of open ports (may be overwritten by the user)*/
+int pcache_size = PCACHE_SIZE;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Initializes the cache of ports*/
+void
+pcache_init
+	(
+	int size_max
+	)
+	{
+	/*The cache is empty*/
+	pcache.mru = pcache.lru = NULL;
+	pcache.size_current = 0;
+	
+	/*Set the limit*/
+	pcache.size_max = size_max;
+	
+	/*Nothing has happened yet*/
+	pcache.opened = pcache.reopened = pcache.evicted = 0;
+	
+	/*Init the lock*/
+	mutex_init(&pcache.lock);
+	}/*pcache_init*/
+/*----------------------------------------------------------------------------*/
+/*Unlinks `node` from the chain (the cache must be locked)*/
+static
+void
+pcache_node_unlink
+	(
+	node_t * node
+	)
+	{
+	/*Obtain the netnode*/
+	struct netnode * nn = node->nn;
+	
+	/*Fix the neighbours*/
+	if(nn->pcache_next)
+		nn->pcache_next->nn->pcache_prev = nn->pcache_prev;
+	if(nn->pcache_prev)
+		nn->pcache_prev->nn->pcache_next = nn->pcache_next;
+	
+	/*Fix the ends of the chain*/
+	if(pcache.mru == node)
+		pcache.mru = nn->pcache_next;
+	if(pcache.lru == node)
+		pcache.lru = nn->pcache_prev;
+		
+	/*The node is out of the cache now*/
+	nn->pcache_next = nn->pcache_prev = NULL;
+	nn->pcache_in = 0;
+	--pcache.size_current;
+	}/*pcache_node_unlink*/
+/*----------------------------------------------------------------------------*/
+/*Closes the least recently used ports until the limit is respected (the
+	cache must be locked)*/
+static
+void
+pcache_shrink(void)
+	{
+	/*The node whose port is being considered for eviction*/
+	node_t * victim, * victim_prev;
+	
+	/*If there is no limit, there is nothing to do*/
+	if(pcache.size_max <= 0)
+		return;
+	
+	/*Go from the LRU end while there are too many ports*/
+	for
+		(
+		victim = pcache.lru;
+		victim && (pcache.size_current > pcache.size_max);
+		victim = victim_prev
+		)
+		{
+		/*remember the next candidate*/
+		victim_prev = victim->nn->pcache_prev;
+		
+		/*A port may only be taken from a node nobody is working with; a node
+			which is busy (possibly with our own thread) is skipped. Trying to
+			lock never blocks, so the lock order does not matter here; and the
+			node cannot be destroyed meanwhile, since node_destroy has to take
+			the lock of the cache to unregister the port.*/
+		if(!mutex_try_lock(&victim->lock))
+			continue;
+		
+		/*close the port; the node will reopen it when it needs it*/
+		pcache_node_unlink(victim);
+		PORT_DEALLOC(victim->nn->port);
+		victim->nn->port = MACH_PORT_NULL;
+		++pcache.evicted;
+		
+		mutex_unlock(&victim->lock);
+		
+		/*report the statistics from time to time*/
+		if(pcache.evicted % PCACHE_REPORT_PERIOD == 0)
+			LOG_MSG("pcache: %d open, %lu opened, %lu reopened, %lu evicted.",
+				pcache.size_current, pcache.opened, pcache.reopened, pcache.evicted);
+		}
+	}/*pcache_shrink*/
+/*----------------------------------------------------------------------------*/
+/*Changes the maximal number of open ports, closing the extra ones*/
+void
+pcache_resize
+	(
+	int size_max
+	)
+	{
+	mutex_lock(&pcache.lock);
+	
+	/*Set the new limit and apply it*/
+	pcache.size_max = size_max;
+	pcache_shrink();
+	
+	mutex_unlock(&pcache.lock);
+	}/*pcache_resize*/
+/*----------------------------------------------------------------------------*/
+/*Registers the open port of `node` (which must be locked) in the cache or
+	marks it as recently used; closes the least recently used ports if there
+	are too many*/
+void
+pcache_port_add
+	(
+	node_t * node,
+	int reopened	/*nonzero if the port had been evicted before*/
+	)
+	{
+	/*The port of the root node is never closed*/
+	if(node == netfs_root_node)
+		return;
+
+	mutex_lock(&pcache.lock);
+	
+	/*If the node is registered already, take it out of the chain*/
+	if(node->nn->pcache_in)
+		pcache_node_unlink(node);
+	else
+		{
+		/*count the new port*/
+		++pcache.opened;
+		if(reopened)
+			++pcache.reopened;
+		}
+	
+	/*Put the node at the MRU end*/
+	node->nn->pcache_next = pcache.mru;
+	node->nn->pcache_prev = NULL;
+	if(pcache.mru)
+		pcache.mru->nn->pcache_prev = node;
+	if(!pcache.lru)
+		pcache.lru = node;
+	pcache.mru = node;
+	node->nn->pcache_in = 1;
+	++pcache.size_current;
+	
+	/*Close the extra ports*/
+	pcache_shrink();
+	
+	mutex_unlock(&pcache.lock);
+	}/*pcache_port_add*/
+/*----------------------------------------------------------------------------*/
+/*Forgets the port of `node`; the port itself is not deallocated*/
+void
+pcache_port_remove
+	(
+	node_t * node
+	)
+	{
+	mutex_lock(&pcache.lock);
+	
+	/*Unlink the node, if it is registered*/
+	if(node->nn->pcache_in)
+		pcache_node_unlink(node);
+	
+	mutex_unlock(&pcache.lock);
+	}/*pcache_port_remove*/
+/*----------------------------------------------------------------------------*/
+/*Copies the statistics of the cache into the parameters*/
+void
+pcache_stats_get
+	(
+	int * open,								/*the number of open ports*/
+	unsigned long * opened,		/*the number of ports opened*/
+	unsigned long * reopened,	/*the number of ports reopened after eviction*/
+	unsigned long * evicted		/*the number of ports evicted*/
+	)
+	{
+	mutex_lock(&pcache.lock);
+	
+	*open			= pcache.size_current;
+	*opened		= pcache.opened;
+	*reopened	= pcache.reopened;
+	*evicted	= pcache.evicted;
+	
+	mutex_unlock(&pcache.lock);
+	}/*pcache_stats_get*/
+/*----------------------------------------------------------------------------*/
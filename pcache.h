@@ -0,0 +1,124 @@
+/*----------------------------------------------------------------------------*/
+/*pcache.h*/
+/*----------------------------------------------------------------------------*/
+/*The cache of ports to the underlying filesystem*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+#ifndef __PCACHE_H__
+#define __PCACHE_H__
+
+/*----------------------------------------------------------------------------*/
+#include <error.h>
+#include <hurd/netfs.h>
+/*----------------------------------------------------------------------------*/
+#include "node.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*The default maximal number of open ports (0 means no limit)*/
+#define PCACHE_SIZE 128
+/*----------------------------------------------------------------------------*/
+/*The number of evictions between two reports of the statistics in the
+	debug log*/
+#define PCACHE_REPORT_PERIOD 256
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*The cache of ports: an LRU chain of nodes which hold an open port to the
+	underlying filesystem. Only the ports are evicted, the nodes stay where
+	they are and reopen their ports when they need them again.*/
+struct pcache
+	{
+	/*the MRU end of the chain*/
+	node_t * mru;
+	
+	/*the LRU end of the chain*/
+	node_t * lru;
+	
+	/*the maximal number of open ports (0 means no limit)*/
+	int size_max;
+	
+	/*the current number of open ports*/
+	int size_current;
+	
+	/*statistics: the number of ports opened, the number of ports reopened
+		after an eviction and the number of ports evicted*/
+	unsigned long opened, reopened, evicted;
+	
+	/*a lock*/
+	struct mutex lock;
+	};/*struct pcache*/
+/*----------------------------------------------------------------------------*/
+typedef struct pcache pcache_t;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The maximal number of open ports (may be overwritten by the user)*/
+extern int pcache_size;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Initializes the cache of ports*/
+void
+pcache_init
+	(
+	int size_max
+	);
+/*----------------------------------------------------------------------------*/
+/*Changes the maximal number of open ports, closing the extra ones*/
+void
+pcache_resize
+	(
+	int size_max
+	);
+/*----------------------------------------------------------------------------*/
+/*Registers the open port of `node` (which must be locked) in the cache or
+	marks it as recently used; closes the least recently used ports if there
+	are too many*/
+void
+pcache_port_add
+	(
+	node_t * node,
+	int reopened	/*nonzero if the port had been evicted before*/
+	);
+/*----------------------------------------------------------------------------*/
+/*Forgets the port of `node`; the port itself is not deallocated*/
+void
+pcache_port_remove
+	(
+	node_t * node
+	);
+/*----------------------------------------------------------------------------*/
+/*Copies the statistics of the cache into the parameters*/
+void
+pcache_stats_get
+	(
+	int * open,								/*the number of open ports*/
+	unsigned long * opened,		/*the number of ports opened*/
+	unsigned long * reopened,	/*the number of ports reopened after eviction*/
+	unsigned long * evicted		/*the number of ports evicted*/
+	);
+/*----------------------------------------------------------------------------*/
+#endif /*__PCACHE_H__*/
@@ -0,0 +1,344 @@
+/*----------------------------------------------------------------------------*/
+/*prefetch.c*/
+/*----------------------------------------------------------------------------*/
+/*The implementation of the background prefetch of verdicts*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*----------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+/*----------------------------------------------------------------------------*/
+#include "prefetch.h"
+#include "filter.h"
+#include "debug.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The maximal number of subdirectories waiting to be prefetched (may be
+	overwritten by the user)*/
+int prefetch_budget = PREFETCH_BUDGET;
+/*----------------------------------------------------------------------------*/
+/*The number of levels prefetched (may be overwritten by the user)*/
+int prefetch_depth = PREFETCH_DEPTH;
+/*----------------------------------------------------------------------------*/
+/*The subdirectories waiting to be prefetched, the newest first, and their
+	number*/
+static prefetch_t * prefetch_first, * prefetch_last;
+static int prefetch_count;
+/*----------------------------------------------------------------------------*/
+/*The subdirectories pushed out of the queue by newer ones; they are freed by
+	the prefetching thread, which holds no locks of nodes*/
+static prefetch_t * prefetch_dropped;
+/*----------------------------------------------------------------------------*/
+/*The lock protecting the queue and the condition signalled when something is
+	queued*/
+static struct mutex prefetch_lock = MUTEX_INITIALIZER;
+static struct condition prefetch_queued;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Destroys `pf`, releasing the directory*/
+static
+void
+prefetch_free
+	(
+	prefetch_t * pf
+	)
+	{
+	netfs_nrele(pf->dir);
+	free(pf->name);
+	free(pf);
+	}/*prefetch_free*/
+/*----------------------------------------------------------------------------*/
+/*Lists the subdirectory described by `pf` in the background class, which
+	records the verdicts on its entries and keeps the listing in its node*/
+static
+void
+prefetch_run
+	(
+	prefetch_t * pf
+	)
+	{
+	error_t err;
+	
+	/*The node of the subdirectory*/
+	node_t * node;
+	
+	/*The entries of the subdirectory*/
+	node_dirent_t * dirents;
+	
+	/*The lnode of the subdirectory, kept while it is looked up*/
+	lnode_t * lnode = NULL;
+	
+	/*The validity token of the verdict on the subdirectory*/
+	struct timespec dir_mtime;
+	unsigned long epoch;
+	
+	/*The verdict, the check of the filter obtaining it, the copy of the path
+		to the directory and the rule applying to its entries*/
+	int verdict = LNODE_VERDICT_UNKNOWN, good;
+	filter_job_t * job;
+	char * path;
+	int rule;
+	
+	mutex_lock(&pf->dir->lock);
+	if(node_dir_mtime_get(pf->dir, &dir_mtime) != 0)
+		{
+		mutex_unlock(&pf->dir->lock);
+		return;
+		}
+	epoch = lnode_epoch(pf->dir->nn->lnode);
+	
+	/*The verdict is usually known from the listing of the directory*/
+	if(lnode_get(pf->dir->nn->lnode, pf->name, &lnode) == 0)
+		{
+		verdict = lnode_verdict_fetch(lnode, dir_mtime, epoch);
+		lnode_ref_remove(lnode);
+		lnode = NULL;
+		}
+	if(verdict == LNODE_VERDICT_UNKNOWN)
+		verdict = node_verdict_lookup(pf->dir, pf->name, dir_mtime, epoch);
+		
+	/*Otherwise, obtain it in the background class, so that the prefetch does
+		not compete with the clients, and record it where the lookup below
+		finds it*/
+	if(verdict == LNODE_VERDICT_UNKNOWN)
+		{
+		err = lnode_rule(pf->dir->nn->lnode, &rule);
+		path = (err) ? (NULL) : (strdup(pf->dir->nn->lnode->path));
+		mutex_unlock(&pf->dir->lock);
+		if(!path)
+			return;
+			
+		err = filter_submit
+			(
+			path, pf->name, rule, FILTER_CLASS_BACKGROUND, FILTER_UID_NONE, &job
+			);
+		if(!err)
+			err = filter_wait(job, &good);
+		free(path);
+		if(err || !good)
+			return;
+			
+		/*a verdict obtained under another property is worthless*/
+		mutex_lock(&pf->dir->lock);
+		if(epoch != lnode_epoch(pf->dir->nn->lnode))
+			{
+			mutex_unlock(&pf->dir->lock);
+			return;
+			}
+		
+		/*the subdirectory is accepted: it gets an lnode, in the same way the
+			lookup does it*/
+		mutex_lock(&pf->dir->nn->lnode->lock);
+		if(lnode_get(pf->dir->nn->lnode, pf->name, &lnode) != 0)
+			{
+			if(lnode_create(pf->name, &lnode) != 0)
+				lnode = NULL;
+			else
+				lnode_install(pf->dir->nn->lnode, lnode);
+			}
+		mutex_unlock(&pf->dir->nn->lnode->lock);
+		if(lnode)
+			{
+			lnode_verdict_store(lnode, 1, dir_mtime, epoch);
+			mutex_unlock(&lnode->lock);
+			}
+		verdict = LNODE_VERDICT_GOOD;
+		}
+		
+	/*Only accepted subdirectories are entered*/
+	if(verdict != LNODE_VERDICT_GOOD)
+		{
+		mutex_unlock(&pf->dir->lock);
+		return;
+		}
+		
+	/*Look the subdirectory up in the same way a client does; its verdict is
+		known now, so the filter does not run*/
+	err = netfs_attempt_lookup(NULL, pf->dir, pf->name, &node);
+	
+	/*The lnode is held by the node now, if there is one*/
+	if(lnode)
+		{
+		mutex_lock(&lnode->lock);
+		lnode_ref_remove(lnode);
+		}
+	if(err)
+		return;
+		
+	/*List the subdirectory and go deeper, if required*/
+	mutex_lock(&node->lock);
+	err = node_entries_get
+		(node, FILTER_UID_NONE, FILTER_CLASS_BACKGROUND, &dirents, 0);
+	if(!err && (pf->depth < prefetch_depth))
+		prefetch_children(node, dirents, pf->depth + 1);
+	mutex_unlock(&node->lock);
+	
+	netfs_nrele(node);
+	}/*prefetch_run*/
+/*----------------------------------------------------------------------------*/
+/*Prefetches the queued subdirectories, the most recently queued first, since
+	those are the most likely to be entered soon*/
+static
+any_t
+prefetch_thread
+	(
+	any_t arg
+	)
+	{
+	/*The subdirectory to prefetch and the dropped ones*/
+	prefetch_t * pf, * dropped, * next;
+	
+	for(;;)
+		{
+		/*Wait for a subdirectory*/
+		mutex_lock(&prefetch_lock);
+		while(!prefetch_first && !prefetch_dropped)
+			condition_wait(&prefetch_queued, &prefetch_lock);
+		
+		/*Take the dropped subdirectories*/
+		dropped = prefetch_dropped;
+		prefetch_dropped = NULL;
+		
+		/*Take the newest subdirectory*/
+		pf = prefetch_first;
+		if(pf)
+			{
+			prefetch_first = pf->next;
+			if(prefetch_first)
+				prefetch_first->prev = NULL;
+			else
+				prefetch_last = NULL;
+			--prefetch_count;
+			}
+		mutex_unlock(&prefetch_lock);
+		
+		/*Forget the dropped subdirectories*/
+		for(; dropped; dropped = next)
+			{
+			next = dropped->next;
+			prefetch_free(dropped);
+			}
+		
+		if(!pf)
+			continue;
+			
+		prefetch_run(pf);
+		prefetch_free(pf);
+		}
+		
+	return 0;
+	}/*prefetch_thread*/
+/*----------------------------------------------------------------------------*/
+/*Starts the thread prefetching the verdicts in subdirectories*/
+error_t
+prefetch_init(void)
+	{
+	condition_init(&prefetch_queued);
+	cthread_detach(cthread_fork(prefetch_thread, NULL));
+	return 0;
+	}/*prefetch_init*/
+/*----------------------------------------------------------------------------*/
+/*Queues the accepted subdirectories among `dirents`, the entries of `dir`
+	(which must be locked), to be listed in the background, so that their
+	verdicts are known by the time they are entered. `depth` is the level
+	of `dir` below the directory listed by a client.*/
+void
+prefetch_children
+	(
+	node_t * dir,
+	node_dirent_t * dirents,
+	int depth
+	)
+	{
+	/*The current entry*/
+	node_dirent_t * dirent;
+	
+	/*The new subdirectory to prefetch and the oldest one*/
+	prefetch_t * pf, * old;
+	
+	/*If the prefetch is disabled or the subdirectories are too deep, stop*/
+	if((prefetch_budget <= 0) || (depth > prefetch_depth))
+		return;
+	
+	for(dirent = dirents; dirent; dirent = dirent->next)
+		{
+		/*only subdirectories are prefetched (not the holes left by the removed
+			entries)*/
+		if
+			(
+			(dirent->dirent->d_type != DT_DIR) || !dirent->dirent->d_ino
+			|| (strcmp(dirent->dirent->d_name, ".") == 0)
+			|| (strcmp(dirent->dirent->d_name, "..") == 0)
+			)
+			continue;
+		
+		/*describe the subdirectory*/
+		pf = malloc(sizeof(prefetch_t));
+		if(!pf)
+			break;
+		pf->name = strdup(dirent->dirent->d_name);
+		if(!pf->name)
+			{
+			free(pf);
+			break;
+			}
+		pf->dir = dir;
+		pf->depth = depth;
+		pf->prev = NULL;
+		netfs_nref(dir);
+		
+		mutex_lock(&prefetch_lock);
+		
+		/*queue it in front of the others*/
+		pf->next = prefetch_first;
+		if(prefetch_first)
+			prefetch_first->prev = pf;
+		else
+			prefetch_last = pf;
+		prefetch_first = pf;
+		
+		/*if the budget is exceeded, drop the oldest subdirectory, the least
+			likely to be entered*/
+		if(++prefetch_count > prefetch_budget)
+			{
+			old = prefetch_last;
+			prefetch_last = old->prev;
+			prefetch_last->next = NULL;
+			--prefetch_count;
+			
+			old->next = prefetch_dropped;
+			prefetch_dropped = old;
+			}
+		
+		condition_signal(&prefetch_queued);
+		mutex_unlock(&prefetch_lock);
+		}
+	}/*prefetch_children*/
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,93 @@
+/*----------------------------------------------------------------------------*/
+/*prefetch.h*/
+/*----------------------------------------------------------------------------*/
+/*Background prefetch of the verdicts in subdirectories*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+/*----------------------------------------------------------------------------*/
+#include <error.h>
+#include <hurd/netfs.h>
+/*----------------------------------------------------------------------------*/
+#include "node.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*The default maximal number of subdirectories waiting to be prefetched (0
+	disables the prefetch)*/
+#define PREFETCH_BUDGET 0
+/*----------------------------------------------------------------------------*/
+/*The default number of levels below a listed directory which are
+	prefetched*/
+#define PREFETCH_DEPTH 1
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Types---------------------------------------------------------------*/
+/*A subdirectory waiting to be prefetched*/
+struct prefetch
+	{
+	/*the directory containing the subdirectory (a reference is held) and the
+		name of the subdirectory*/
+	node_t * dir;
+	char * name;
+	
+	/*the level of the subdirectory below the listed directory*/
+	int depth;
+	
+	/*the neighbours in the queue*/
+	struct prefetch * prev, * next;
+	};/*struct prefetch*/
+/*----------------------------------------------------------------------------*/
+typedef struct prefetch prefetch_t;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The maximal number of subdirectories waiting to be prefetched and the
+	number of levels prefetched (may be overwritten by the user)*/
+extern int prefetch_budget;
+extern int prefetch_depth;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Starts the thread prefetching the verdicts in subdirectories*/
+error_t
+prefetch_init(void);
+/*----------------------------------------------------------------------------*/
+/*Queues the accepted subdirectories among `dirents`, the entries of `dir`
+	(which must be locked), to be listed in the background, so that their
+	verdicts are known by the time they are entered. `depth` is the level
+	of `dir` below the directory listed by a client.*/
+void
+prefetch_children
+	(
+	node_t * dir,
+	node_dirent_t * dirents,
+	int depth
+	);
+/*----------------------------------------------------------------------------*/
+#endif /*__PREFETCH_H__*/
@@ -0,0 +1,397 @@
+/*----------------------------------------------------------------------------*/
+/*readahead.c*/
+/*----------------------------------------------------------------------------*/
+/*The implementation of sequential read-ahead for files*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*----------------------------------------------------------------------------*/
+#include <sys/mman.h>
+/*----------------------------------------------------------------------------*/
+#include "readahead.h"
+#include "node.h"
+#include "lib.h"
+#include "debug.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The memory budget of read-ahead (may be overwritten by the user)*/
+size_t readahead_budget = READAHEAD_BUDGET;
+/*----------------------------------------------------------------------------*/
+/*The amount of memory currently charged to read-ahead*/
+static size_t readahead_used;
+/*----------------------------------------------------------------------------*/
+/*The lock protecting `readahead_used`*/
+static struct mutex readahead_budget_lock = MUTEX_INITIALIZER;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Structures----------------------------------------------------------*/
+/*A fetch running in the background*/
+struct readahead_fetch
+	{
+	/*the read-ahead state to put the data into and the node it belongs to
+		(the fetch holds a reference to the node, so the state lives at least
+		as long as the fetch)*/
+	readahead_t * ra;
+	node_t * node;
+	
+	/*our own send right to the file (the node may lose its port meanwhile)*/
+	file_t port;
+	
+	/*the range to fetch*/
+	loff_t offset;
+	size_t len;
+	};/*struct readahead_fetch*/
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Tries to charge `bytes` to the budget; returns nonzero on success*/
+static
+int
+readahead_charge
+	(
+	size_t bytes
+	)
+	{
+	int ok;
+	
+	mutex_lock(&readahead_budget_lock);
+	
+	/*Charge the bytes if they fit into the budget*/
+	ok = (readahead_used + bytes <= readahead_budget);
+	if(ok)
+		readahead_used += bytes;
+		
+	mutex_unlock(&readahead_budget_lock);
+	
+	return ok;
+	}/*readahead_charge*/
+/*----------------------------------------------------------------------------*/
+/*Returns `bytes` to the budget*/
+static
+void
+readahead_uncharge
+	(
+	size_t bytes
+	)
+	{
+	mutex_lock(&readahead_budget_lock);
+	readahead_used -= bytes;
+	mutex_unlock(&readahead_budget_lock);
+	}/*readahead_uncharge*/
+/*----------------------------------------------------------------------------*/
+/*Frees the data fetched ahead in `ra` (which must be locked)*/
+static
+void
+readahead_buf_free
+	(
+	readahead_t * ra
+	)
+	{
+	/*Free the memory sent by the underlying filesystem*/
+	if(ra->buf && ra->buf_len)
+		munmap(ra->buf, ra->buf_len);
+	
+	/*Return the memory to the budget*/
+	if(ra->buf_charge)
+		readahead_uncharge(ra->buf_charge);
+		
+	ra->buf = NULL;
+	ra->buf_len = ra->buf_charge = 0;
+	ra->eof = 0;
+	}/*readahead_buf_free*/
+/*----------------------------------------------------------------------------*/
+/*Fetches the data described by `arg` (a struct readahead_fetch); runs in a
+	thread of its own*/
+static
+any_t
+readahead_fetch
+	(
+	any_t arg
+	)
+	{
+	/*The description of the fetch*/
+	struct readahead_fetch * fetch = arg;
+	readahead_t * ra = fetch->ra;
+	
+	/*The data and their length; let the stub allocate the memory*/
+	char * buf = NULL;
+	mach_msg_type_number_t buf_len = 0;
+
+	/*Read the data*/
+	error_t err = io_read(fetch->port, &buf, &buf_len, fetch->offset, fetch->len);
+	
+	/*Our right to the file is not needed any more*/
+	PORT_DEALLOC(fetch->port);
+	
+	mutex_lock(&ra->lock);
+	
+	/*Replace the old data with the new ones*/
+	readahead_buf_free(ra);
+	if(!err)
+		{
+		ra->buf = buf;
+		ra->buf_offset = fetch->offset;
+		ra->buf_len = buf_len;
+		ra->buf_charge = fetch->len;
+		
+		/*a short read means the end of the file*/
+		ra->eof = (buf_len < fetch->len);
+		}
+	else
+		readahead_uncharge(fetch->len);
+	
+	/*The fetch is over, wake up whoever is waiting for it*/
+	ra->pending = 0;
+	condition_broadcast(&ra->done);
+	
+	mutex_unlock(&ra->lock);
+	
+	/*The node may go away now*/
+	netfs_nrele(fetch->node);
+	
+	free(fetch);
+	return 0;
+	}/*readahead_fetch*/
+/*----------------------------------------------------------------------------*/
+/*Tries to serve a read of `len` bytes at `offset` from `node` (which must be
+	locked) from the data fetched ahead; returns ENODATA if it cannot*/
+error_t
+readahead_read
+	(
+	node_t * node,
+	loff_t offset,
+	size_t * len,
+	void * data
+	)
+	{
+	error_t err = ENODATA;
+
+	/*The read-ahead state of the node*/
+	readahead_t * ra = node->nn->ra;
+	
+	/*The number of bytes which can be served*/
+	size_t avail;
+	
+	/*If nothing has ever been fetched ahead, stop*/
+	if(!ra)
+		return err;
+		
+	mutex_lock(&ra->lock);
+	
+	/*If the requested data are being fetched right now, wait for them: this
+		is sooner than asking for them once more*/
+	while
+		(
+		ra->pending && (offset >= ra->pending_offset)
+		&& (offset < ra->pending_offset + ra->pending_len)
+		)
+		condition_wait(&ra->done, &ra->lock);
+	
+	/*If the data fetched ahead contain the beginning of the requested range*/
+	if(ra->buf && (offset >= ra->buf_offset)
+		&& (offset < ra->buf_offset + ra->buf_len))
+		{
+		avail = ra->buf_offset + ra->buf_len - offset;
+		
+		/*serve the read if the whole range is there, or if the rest of the
+			file is shorter than the range anyway*/
+		if((avail >= *len) || ra->eof)
+			{
+			if(avail < *len)
+				*len = avail;
+			memcpy(data, ra->buf + (offset - ra->buf_offset), *len);
+			err = 0;
+			}
+		}
+		
+	mutex_unlock(&ra->lock);
+	
+	/*If the read has been served, it is part of the access pattern, too*/
+	if(!err)
+		readahead_note(node, offset, *len);
+		
+	/*Return the result*/
+	return err;
+	}/*readahead_read*/
+/*----------------------------------------------------------------------------*/
+/*Records that `len` bytes have been read at `offset` from `node` (which must
+	be locked and have an open port); fetches the following data in the
+	background if the file is being read sequentially*/
+void
+readahead_note
+	(
+	node_t * node,
+	loff_t offset,
+	size_t len
+	)
+	{
+	/*The read-ahead state of the node*/
+	readahead_t * ra = node->nn->ra;
+	
+	/*The fetch to start*/
+	struct readahead_fetch * fetch;
+	
+	/*If read-ahead is disabled, do nothing*/
+	if(readahead_budget == 0)
+		return;
+
+	/*Create the read-ahead state on the first read*/
+	if(!ra)
+		{
+		ra = calloc(1, sizeof(readahead_t));
+		if(!ra)
+			return;
+		mutex_init(&ra->lock);
+		condition_init(&ra->done);
+		
+		/*the node is locked, nobody else can be doing this*/
+		node->nn->ra = ra;
+		}
+	
+	mutex_lock(&ra->lock);
+	
+	/*If this read continues the previous one, the file is being read
+		sequentially: open the window wider; otherwise close it*/
+	if(offset == ra->next)
+		ra->window = (ra->window)
+			? ((ra->window * 2 > READAHEAD_WINDOW_MAX)
+				? (READAHEAD_WINDOW_MAX) : (ra->window * 2))
+			: (READAHEAD_WINDOW_MIN);
+	else
+		ra->window = 0;
+	ra->next = offset + len;
+	
+	/*If there is nothing to fetch: the reading is not sequential, a fetch is
+		already going on, or the file has been read up to its end*/
+	if
+		(
+		!ra->window || ra->pending
+		|| (ra->buf && ra->eof && (ra->next >= ra->buf_offset + ra->buf_len))
+		)
+		{
+		mutex_unlock(&ra->lock);
+		return;
+		}
+		
+	/*If the data fetched ahead will last for at least half a window more,
+		fetching can wait*/
+	if
+		(
+		ra->buf && (ra->next >= ra->buf_offset)
+		&& (ra->next + ra->window / 2 <= ra->buf_offset + ra->buf_len)
+		)
+		{
+		mutex_unlock(&ra->lock);
+		return;
+		}
+	
+	/*Charge the window to the global budget; if it does not fit, do not
+		fetch anything*/
+	if(!readahead_charge(ra->window))
+		{
+		mutex_unlock(&ra->lock);
+		return;
+		}
+		
+	/*Describe the fetch*/
+	fetch = malloc(sizeof(struct readahead_fetch));
+	if(!fetch)
+		{
+		readahead_uncharge(ra->window);
+		mutex_unlock(&ra->lock);
+		return;
+		}
+	fetch->ra = ra;
+	fetch->node = node;
+	netfs_nref(node);
+	fetch->offset = ra->next;
+	fetch->len = ra->window;
+	
+	/*The fetch gets its own right to the file*/
+	fetch->port = node->nn->port;
+	mach_port_mod_refs(mach_task_self(), fetch->port, MACH_PORT_RIGHT_SEND, 1);
+	
+	/*Start fetching in the background*/
+	ra->pending = 1;
+	ra->pending_offset = fetch->offset;
+	ra->pending_len = fetch->len;
+	cthread_detach(cthread_fork(readahead_fetch, fetch));
+	
+	mutex_unlock(&ra->lock);
+	}/*readahead_note*/
+/*----------------------------------------------------------------------------*/
+/*Drops the data fetched ahead for `node` (e.g. because the file has been
+	modified), waiting for the fetch in progress to complete*/
+void
+readahead_drop
+	(
+	node_t * node
+	)
+	{
+	/*The read-ahead state of the node*/
+	readahead_t * ra = node->nn->ra;
+	
+	/*If there is nothing to drop, stop*/
+	if(!ra)
+		return;
+		
+	mutex_lock(&ra->lock);
+	
+	/*Wait until the fetch in progress is over*/
+	while(ra->pending)
+		condition_wait(&ra->done, &ra->lock);
+	
+	/*Drop the data and start detecting the access pattern anew*/
+	readahead_buf_free(ra);
+	ra->window = 0;
+	
+	mutex_unlock(&ra->lock);
+	}/*readahead_drop*/
+/*----------------------------------------------------------------------------*/
+/*Destroys the read-ahead state of `node`; no fetch can be in progress,
+	because a fetch keeps the node alive*/
+void
+readahead_destroy
+	(
+	node_t * node
+	)
+	{
+	/*The read-ahead state of the node*/
+	readahead_t * ra = node->nn->ra;
+	
+	/*If nothing has ever been fetched ahead, stop*/
+	if(!ra)
+		return;
+	assert(!ra->pending);
+	
+	/*Free the data and the state itself*/
+	readahead_buf_free(ra);
+	free(ra);
+	node->nn->ra = NULL;
+	}/*readahead_destroy*/
+/*----------------------------------------------------------------------------*/
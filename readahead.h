@@ -0,0 +1,128 @@
+/*----------------------------------------------------------------------------*/
+/*readahead.h*/
+/*----------------------------------------------------------------------------*/
+/*Sequential read-ahead for files*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+#ifndef __READAHEAD_H__
+#define __READAHEAD_H__
+
+/*----------------------------------------------------------------------------*/
+#include <error.h>
+#include <hurd/netfs.h>
+/*----------------------------------------------------------------------------*/
+#include "lnode.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*The default amount of memory all read-ahead buffers may occupy together
+	(0 disables read-ahead)*/
+#define READAHEAD_BUDGET (4 * 1024 * 1024)
+/*----------------------------------------------------------------------------*/
+/*The initial and the maximal size of the read-ahead window*/
+#define READAHEAD_WINDOW_MIN (16 * 1024)
+#define READAHEAD_WINDOW_MAX (256 * 1024)
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*The read-ahead state of a file*/
+struct readahead
+	{
+	/*the offset at which the next read starts if reading is sequential*/
+	loff_t next;
+	
+	/*the current size of the window (0 while reading is not sequential)*/
+	size_t window;
+	
+	/*the data fetched ahead, the offset they start at and their length*/
+	char * buf;
+	loff_t buf_offset;
+	size_t buf_len;
+	
+	/*the number of bytes of the budget charged for `buf`*/
+	size_t buf_charge;
+	
+	/*nonzero if `buf` reaches the end of the file*/
+	int eof;
+	
+	/*nonzero while a fetch is in progress; the offset and the length of the
+		data being fetched and the budget charged for them*/
+	int pending;
+	loff_t pending_offset;
+	size_t pending_len;
+	
+	/*a lock and a condition signalled when a fetch completes*/
+	struct mutex lock;
+	struct condition done;
+	};/*struct readahead*/
+/*----------------------------------------------------------------------------*/
+typedef struct readahead readahead_t;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The memory budget of read-ahead (may be overwritten by the user)*/
+extern size_t readahead_budget;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Tries to serve a read of `len` bytes at `offset` from `node` (which must be
+	locked) from the data fetched ahead; returns ENODATA if it cannot*/
+error_t
+readahead_read
+	(
+	node_t * node,
+	loff_t offset,
+	size_t * len,
+	void * data
+	);
+/*----------------------------------------------------------------------------*/
+/*Records that `len` bytes have been read at `offset` from `node` (which must
+	be locked and have an open port); fetches the following data in the
+	background if the file is being read sequentially*/
+void
+readahead_note
+	(
+	node_t * node,
+	loff_t offset,
+	size_t len
+	);
+/*----------------------------------------------------------------------------*/
+/*Drops the data fetched ahead for `node` (e.g. because the file has been
+	modified), waiting for the fetch in progress to complete*/
+void
+readahead_drop
+	(
+	node_t * node
+	);
+/*----------------------------------------------------------------------------*/
+/*Destroys the read-ahead state of `node`; no fetch can be in progress,
+	because a fetch keeps the node alive*/
+void
+readahead_destroy
+	(
+	node_t * node
+	);
+/*----------------------------------------------------------------------------*/
+#endif /*__READAHEAD_H__*/
@@ -0,0 +1,273 @@
+/*----------------------------------------------------------------------------*/
+/*refresh.c*/
+/*----------------------------------------------------------------------------*/
+/*The implementation of the refresh-ahead of listings*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*----------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <maptime.h>
+/*----------------------------------------------------------------------------*/
+#include "refresh.h"
+#include "filter.h"
+#include "lnode.h"
+#include "filterfs.h"
+#include "debug.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The maximal number of directories watched (may be overwritten by the
+	user)*/
+int refresh_size = REFRESH_SIZE;
+/*----------------------------------------------------------------------------*/
+/*The time after which an unused directory is forgotten (may be overwritten
+	by the user)*/
+int refresh_idle = REFRESH_IDLE;
+/*----------------------------------------------------------------------------*/
+/*The directories watched, the most recently listed first, and their
+	number*/
+static refresh_t * refresh_list;
+static int refresh_count;
+/*----------------------------------------------------------------------------*/
+/*The directories which are not watched any more; they are released by the
+	refreshing thread, which holds no locks of nodes*/
+static refresh_t * refresh_dropped;
+/*----------------------------------------------------------------------------*/
+/*The lock protecting the lists*/
+static struct mutex refresh_lock = MUTEX_INITIALIZER;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Returns the current time in seconds*/
+static
+time_t
+refresh_now(void)
+	{
+	struct timeval tv;
+	maptime_read(maptime, &tv);
+	return tv.tv_sec;
+	}/*refresh_now*/
+/*----------------------------------------------------------------------------*/
+/*Revalidates the listing of `node`: the attributes of the directory are
+	fetched anew and, if the directory has changed, it is listed again in
+	the background class; only the entries which have changed are given to
+	the filter (see node_entries_get)*/
+static
+void
+refresh_run
+	(
+	node_t * node
+	)
+	{
+	/*The entries of the directory*/
+	node_dirent_t * dirents;
+	
+	mutex_lock(&node->lock);
+	lnode_stat_invalidate(node->nn->lnode);
+	node_entries_get
+		(node, FILTER_UID_NONE, FILTER_CLASS_BACKGROUND, &dirents, 0);
+	mutex_unlock(&node->lock);
+	}/*refresh_run*/
+/*----------------------------------------------------------------------------*/
+/*Refreshes the listings of hot directories a second before the cached
+	attributes of the directories expire and forgets the directories nobody
+	lists any more*/
+static
+any_t
+refresh_thread
+	(
+	any_t arg
+	)
+	{
+	/*The current time and the interval between the refreshes*/
+	time_t now;
+	int interval;
+	
+	/*The current directory, the link to it and the dropped directories*/
+	refresh_t * r, ** link, * dropped;
+	
+	/*The directories to refresh now and their number*/
+	node_t ** nodes;
+	int count, i;
+	
+	for(;;)
+		{
+		sleep(1);
+		
+		now = refresh_now();
+		interval = (lnode_attr_timeout > 1) ? (lnode_attr_timeout - 1) : (1);
+		count = 0;
+		
+		mutex_lock(&refresh_lock);
+		
+		/*Find the directories to refresh and take a reference to each*/
+		nodes = malloc((refresh_count + 1) * sizeof(node_t *));
+		for(link = &refresh_list; (r = *link) != NULL;)
+			{
+			/*a directory nobody lists any more is forgotten*/
+			if(now - r->used > refresh_idle)
+				{
+				*link = r->next;
+				--refresh_count;
+				r->next = refresh_dropped;
+				refresh_dropped = r;
+				continue;
+				}
+				
+			/*a hot directory is refreshed when its attributes are about to
+				expire, any directory when it is due at once*/
+			if
+				(
+				nodes
+				&& ((r->refreshed == 0)
+					|| ((r->hits >= REFRESH_HITS) && (now - r->refreshed >= interval)))
+				)
+				{
+				r->refreshed = now;
+				netfs_nref(r->node);
+				nodes[count++] = r->node;
+				}
+				
+			link = &r->next;
+			}
+			
+		/*Take the dropped directories*/
+		dropped = refresh_dropped;
+		refresh_dropped = NULL;
+		
+		mutex_unlock(&refresh_lock);
+		
+		/*Release the dropped directories*/
+		for(; dropped; dropped = r)
+			{
+			r = dropped->next;
+			netfs_nrele(dropped->node);
+			free(dropped);
+			}
+			
+		/*Refresh the hot directories*/
+		for(i = 0; i < count; ++i)
+			{
+			refresh_run(nodes[i]);
+			netfs_nrele(nodes[i]);
+			}
+		free(nodes);
+		}
+		
+	return 0;
+	}/*refresh_thread*/
+/*----------------------------------------------------------------------------*/
+/*Starts the thread refreshing the listings of hot directories*/
+error_t
+refresh_init(void)
+	{
+	cthread_detach(cthread_fork(refresh_thread, NULL));
+	return 0;
+	}/*refresh_init*/
+/*----------------------------------------------------------------------------*/
+/*Notes that a client has listed `dir` (which must be locked); directories
+	listed often have their listings revalidated in the background before
+	the cached attributes of the directory expire, so that the clients
+	always find them ready*/
+void
+refresh_note
+	(
+	node_t * dir
+	)
+	{
+	/*The current directory and the link to it*/
+	refresh_t * r, ** link;
+	
+	/*If the refresh-ahead is disabled, stop*/
+	if(refresh_size <= 0)
+		return;
+		
+	mutex_lock(&refresh_lock);
+	
+	/*Find the directory among the watched ones*/
+	for
+		(
+		link = &refresh_list; *link && ((*link)->node != dir);
+		link = &(*link)->next
+		);
+	r = *link;
+	
+	if(r)
+		{
+		/*count the listing and move the directory to the front*/
+		++r->hits;
+		*link = r->next;
+		}
+	else
+		{
+		/*start watching the directory*/
+		r = malloc(sizeof(refresh_t));
+		if(!r)
+			{
+			mutex_unlock(&refresh_lock);
+			return;
+			}
+		r->node = dir;
+		r->hits = 1;
+		r->refreshed = refresh_now();
+		netfs_nref(dir);
+		++refresh_count;
+		}
+	r->used = refresh_now();
+	r->next = refresh_list;
+	refresh_list = r;
+	
+	/*If too many directories are watched, drop the least recently listed
+		one*/
+	if(refresh_count > refresh_size)
+		{
+		for(link = &refresh_list; (*link)->next; link = &(*link)->next);
+		r = *link;
+		*link = NULL;
+		--refresh_count;
+		r->next = refresh_dropped;
+		refresh_dropped = r;
+		}
+		
+	mutex_unlock(&refresh_lock);
+	}/*refresh_note*/
+/*----------------------------------------------------------------------------*/
+/*Has all watched directories, hot or not, filtered anew in the background
+	as soon as possible (after the property has changed)*/
+void
+refresh_all(void)
+	{
+	/*The current directory*/
+	refresh_t * r;
+	
+	mutex_lock(&refresh_lock);
+	for(r = refresh_list; r; r = r->next)
+		r->refreshed = 0;
+	mutex_unlock(&refresh_lock);
+	}/*refresh_all*/
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,100 @@
+/*----------------------------------------------------------------------------*/
+/*refresh.h*/
+/*----------------------------------------------------------------------------*/
+/*Refresh-ahead of the listings of hot directories*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+#ifndef __REFRESH_H__
+#define __REFRESH_H__
+
+/*----------------------------------------------------------------------------*/
+#include <error.h>
+#include <hurd/netfs.h>
+/*----------------------------------------------------------------------------*/
+#include "node.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*The default maximal number of directories watched for refresh-ahead (0
+	disables the refresh-ahead)*/
+#define REFRESH_SIZE 0
+/*----------------------------------------------------------------------------*/
+/*The number of times a directory must be listed to be considered hot*/
+#define REFRESH_HITS 2
+/*----------------------------------------------------------------------------*/
+/*The default time in seconds after which a directory nobody lists is not
+	refreshed any more*/
+#define REFRESH_IDLE 30
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Types---------------------------------------------------------------*/
+/*A directory watched for refresh-ahead*/
+struct refresh
+	{
+	/*the directory (a reference is held)*/
+	node_t * node;
+	
+	/*the number of times the directory has been listed by clients, the last
+		time it was listed and the last time it was refreshed (0 if it must
+		be refreshed at once)*/
+	int hits;
+	time_t used, refreshed;
+	
+	/*the next directory, the less recently listed ones follow*/
+	struct refresh * next;
+	};/*struct refresh*/
+/*----------------------------------------------------------------------------*/
+typedef struct refresh refresh_t;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The maximal number of directories watched and the time after which an
+	unused one is forgotten (may be overwritten by the user)*/
+extern int refresh_size;
+extern int refresh_idle;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Starts the thread refreshing the listings of hot directories*/
+error_t
+refresh_init(void);
+/*----------------------------------------------------------------------------*/
+/*Notes that a client has listed `dir` (which must be locked); directories
+	listed often have their listings revalidated in the background before
+	the cached attributes of the directory expire, so that the clients
+	always find them ready*/
+void
+refresh_note
+	(
+	node_t * dir
+	);
+/*----------------------------------------------------------------------------*/
+/*Has all watched directories, hot or not, filtered anew in the background
+	as soon as possible (after the property has changed)*/
+void
+refresh_all(void);
+/*----------------------------------------------------------------------------*/
+#endif /*__REFRESH_H__*/
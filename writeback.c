@@ -0,0 +1,448 @@
+/*----------------------------------------------------------------------------*/
+/*writeback.c*/
+/*----------------------------------------------------------------------------*/
+/*The implementation of forwarding of writes to the underlying filesystem*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+#define _GNU_SOURCE 1
+/*----------------------------------------------------------------------------*/
+#include <unistd.h>
+#include <maptime.h>
+/*----------------------------------------------------------------------------*/
+#include "writeback.h"
+#include "readahead.h"
+#include "bcache.h"
+#include "filterfs.h"
+#include "lib.h"
+#include "debug.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The size of the write-behind buffers (may be overwritten by the user)*/
+size_t writeback_size = WRITEBACK_SIZE;
+/*----------------------------------------------------------------------------*/
+/*The time buffered data may wait (may be overwritten by the user)*/
+int writeback_timeout = WRITEBACK_TIMEOUT;
+/*----------------------------------------------------------------------------*/
+/*The list of files with buffered data, the oldest ones first*/
+static writeback_t * writeback_dirty_first, * writeback_dirty_last;
+/*----------------------------------------------------------------------------*/
+/*The lock protecting the list of files with buffered data*/
+static struct mutex writeback_lock = MUTEX_INITIALIZER;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Returns the current time in seconds*/
+static
+time_t
+writeback_now(void)
+	{
+	struct timeval tv;
+	maptime_read(maptime, &tv);
+	return tv.tv_sec;
+	}/*writeback_now*/
+/*----------------------------------------------------------------------------*/
+/*Adds `wb` to the end of the list of files with buffered data; the list
+	holds a reference to the node (which must be locked), so a node with
+	buffered data is never destroyed*/
+static
+void
+writeback_dirty_add
+	(
+	writeback_t * wb
+	)
+	{
+	netfs_nref(wb->node);
+	
+	mutex_lock(&writeback_lock);
+	
+	/*Remember when the data started waiting*/
+	wb->timestamp = writeback_now();
+	
+	/*Append the file to the list*/
+	wb->next = NULL;
+	wb->prev = writeback_dirty_last;
+	if(writeback_dirty_last)
+		writeback_dirty_last->next = wb;
+	else
+		writeback_dirty_first = wb;
+	writeback_dirty_last = wb;
+	wb->dirty = 1;
+	
+	mutex_unlock(&writeback_lock);
+	}/*writeback_dirty_add*/
+/*----------------------------------------------------------------------------*/
+/*Unlinks `wb` from the list of files with buffered data (which must be
+	locked)*/
+static
+void
+writeback_dirty_unlink
+	(
+	writeback_t * wb
+	)
+	{
+	/*fix the neighbours*/
+	if(wb->next)
+		wb->next->prev = wb->prev;
+	else
+		writeback_dirty_last = wb->prev;
+	if(wb->prev)
+		wb->prev->next = wb->next;
+	else
+		writeback_dirty_first = wb->next;
+		
+	wb->next = wb->prev = NULL;
+	wb->dirty = 0;
+	}/*writeback_dirty_unlink*/
+/*----------------------------------------------------------------------------*/
+/*Removes `wb` from the list of files with buffered data, if it is there, and
+	drops the reference the list held to the node (which must be locked and
+	referenced by the caller, so this is never the last reference)*/
+static
+void
+writeback_dirty_remove
+	(
+	writeback_t * wb
+	)
+	{
+	/*Whether the file was in the list*/
+	int dirty;
+	
+	mutex_lock(&writeback_lock);
+	dirty = wb->dirty;
+	if(dirty)
+		writeback_dirty_unlink(wb);
+	mutex_unlock(&writeback_lock);
+	
+	if(dirty)
+		netfs_nrele(wb->node);
+	}/*writeback_dirty_remove*/
+/*----------------------------------------------------------------------------*/
+/*Drops whatever has been cached about the contents and the attributes of
+	`node` (which must be locked), after it has been modified*/
+void
+writeback_invalidate
+	(
+	node_t * node
+	)
+	{
+	/*The size and the times of the file have changed*/
+	lnode_stat_invalidate(node->nn->lnode);
+	
+	/*The data read ahead or cached in blocks are out of date*/
+	readahead_drop(node);
+	bcache_file_drop(&node->nn_stat);
+	}/*writeback_invalidate*/
+/*----------------------------------------------------------------------------*/
+/*Writes `len` bytes from `data` at `offset` directly into the underlying
+	file of `node` (which must be locked)*/
+static
+error_t
+writeback_forward
+	(
+	node_t * node,
+	loff_t offset,
+	size_t * len,
+	void * data
+	)
+	{
+	error_t err;
+	
+	/*The number of bytes actually written*/
+	vm_size_t amount;
+	
+	/*Make sure there is a port open for writing (a port opened for reading
+		only is reopened for both)*/
+	err = node_port_ensure(node, O_WRITE);
+	if(err)
+		return err;
+	
+	/*Write the data*/
+	err = io_write(node->nn->port, data, *len, offset, &amount);
+	if(!err)
+		*len = amount;
+		
+	/*Whatever was cached about the file is out of date now*/
+	writeback_invalidate(node);
+	
+	return err;
+	}/*writeback_forward*/
+/*----------------------------------------------------------------------------*/
+/*Writes out the buffered data of `node` (which must be locked); an error is
+	kept to be reported by writeback_sync or by the next write*/
+void
+writeback_flush
+	(
+	node_t * node
+	)
+	{
+	error_t err = 0;
+	
+	/*The write-behind state of the node*/
+	writeback_t * wb = node->nn->wb;
+	
+	/*The number of bytes written so far and in one go*/
+	size_t done, n;
+	
+	/*If nothing is buffered, stop*/
+	if(!wb || !wb->len)
+		return;
+		
+	/*Write the data, possibly in several pieces*/
+	for(done = 0; !err && (done < wb->len); done += n)
+		{
+		n = wb->len - done;
+		err = writeback_forward(node, wb->offset + done, &n, wb->buf + done);
+		
+		/*the underlying file refusing to take anything is an error*/
+		if(!err && !n)
+			err = EIO;
+		}
+	
+	/*Whatever happened, the data are not buffered any more*/
+	wb->len = 0;
+	writeback_dirty_remove(wb);
+	
+	/*Keep the error until somebody can be told about it*/
+	if(err && !wb->err)
+		wb->err = err;
+	}/*writeback_flush*/
+/*----------------------------------------------------------------------------*/
+/*Writes out the buffered data of `node` (which must be locked) and reports
+	the error of this or of any earlier write in the background*/
+error_t
+writeback_sync
+	(
+	node_t * node
+	)
+	{
+	error_t err;
+	
+	/*If there has never been any buffering, there is nothing to report*/
+	if(!node->nn->wb)
+		return 0;
+	
+	/*Write out the data and take the error*/
+	writeback_flush(node);
+	err = node->nn->wb->err;
+	node->nn->wb->err = 0;
+	
+	return err;
+	}/*writeback_sync*/
+/*----------------------------------------------------------------------------*/
+/*Writes `len` bytes from `data` at `offset` into `node` (which must be
+	locked), either directly or through the write-behind buffer*/
+error_t
+writeback_write
+	(
+	node_t * node,
+	loff_t offset,
+	size_t * len,
+	void * data
+	)
+	{
+	error_t err;
+	
+	/*The write-behind state of the node*/
+	writeback_t * wb = node->nn->wb;
+
+	/*If write-behind is disabled or the write is too large to be worth
+		buffering, write the data through, after the buffered ones*/
+	if((writeback_size == 0) || (*len >= writeback_size))
+		{
+		err = writeback_sync(node);
+		if(!err)
+			err = writeback_forward(node, offset, len, data);
+		return err;
+		}
+		
+	/*Create the write-behind state on the first buffered write*/
+	if(!wb)
+		{
+		wb = calloc(1, sizeof(writeback_t));
+		if(!wb)
+			return ENOMEM;
+		wb->node = node;
+		node->nn->wb = wb;
+		}
+		
+	/*If the size of the buffers has been changed, reallocate the buffer*/
+	if(wb->size != writeback_size)
+		{
+		writeback_flush(node);
+		free(wb->buf);
+		wb->buf = malloc(writeback_size);
+		wb->size = (wb->buf) ? (writeback_size) : (0);
+		if(!wb->buf)
+			return ENOMEM;
+		}
+	
+	/*If the data do not continue the buffered ones or do not fit after them,
+		write out the buffered data first*/
+	if(wb->len && ((offset != wb->offset + wb->len) || (wb->len + *len > wb->size)))
+		writeback_flush(node);
+		
+	/*If an earlier write has failed, report it now*/
+	if(wb->err)
+		{
+		err = wb->err;
+		wb->err = 0;
+		return err;
+		}
+	
+	/*If the buffer is empty, the data start waiting now*/
+	if(!wb->len)
+		{
+		wb->offset = offset;
+		writeback_dirty_add(wb);
+		}
+	
+	/*Buffer the data*/
+	memcpy(wb->buf + wb->len, data, *len);
+	wb->len += *len;
+	
+	/*If the buffer is full, write it out*/
+	if(wb->len >= wb->size)
+		return writeback_sync(node);
+		
+	/*The attributes of the file will change once the data are written*/
+	lnode_stat_invalidate(node->nn->lnode);
+	
+	/*All data have been accepted*/
+	return 0;
+	}/*writeback_write*/
+/*----------------------------------------------------------------------------*/
+/*Writes out the buffered data of files, starting from the oldest; if
+	`expired_only` is nonzero, stops at the first file whose data have not
+	waited for long enough*/
+static
+void
+writeback_flush_list
+	(
+	int expired_only
+	)
+	{
+	/*The node whose data are being written out*/
+	node_t * node;
+	
+	for(;;)
+		{
+		mutex_lock(&writeback_lock);
+		
+		/*Stop if there is no file left, or if the oldest one can wait*/
+		if
+			(
+			!writeback_dirty_first
+			|| (expired_only
+				&& (writeback_now() - writeback_dirty_first->timestamp
+					< writeback_timeout))
+			)
+			{
+			mutex_unlock(&writeback_lock);
+			break;
+			}
+		
+		/*Take the file off the list together with the reference the list
+			held to the node, which keeps the node alive while the list is not
+			locked (the node must be locked after the list is unlocked, because
+			writers hold the lock of the node when they come to the list)*/
+		node = writeback_dirty_first->node;
+		writeback_dirty_unlink(writeback_dirty_first);
+		
+		mutex_unlock(&writeback_lock);
+		
+		/*Write out the data*/
+		mutex_lock(&node->lock);
+		writeback_flush(node);
+		mutex_unlock(&node->lock);
+		
+		/*The node may go away now; it has no buffered data left*/
+		netfs_nrele(node);
+		}
+	}/*writeback_flush_list*/
+/*----------------------------------------------------------------------------*/
+/*Writes out the buffered data of all files*/
+void
+writeback_flush_all(void)
+	{
+	writeback_flush_list(0);
+	}/*writeback_flush_all*/
+/*----------------------------------------------------------------------------*/
+/*Writes out the data which have waited for too long; runs in a thread of
+	its own*/
+static
+any_t
+writeback_thread
+	(
+	any_t arg
+	)
+	{
+	for(;;)
+		{
+		/*Check the list once a second*/
+		sleep(1);
+		writeback_flush_list(1);
+		}
+		
+	return 0;
+	}/*writeback_thread*/
+/*----------------------------------------------------------------------------*/
+/*Starts the thread writing out the data which have waited too long*/
+error_t
+writeback_init(void)
+	{
+	cthread_detach(cthread_fork(writeback_thread, NULL));
+	return 0;
+	}/*writeback_init*/
+/*----------------------------------------------------------------------------*/
+/*Destroys the write-behind state of `node`; nothing is buffered any more,
+	because the list of files with buffered data keeps the node alive*/
+void
+writeback_destroy
+	(
+	node_t * node
+	)
+	{
+	/*The write-behind state of the node*/
+	writeback_t * wb = node->nn->wb;
+	
+	/*If there has never been any buffering, there is nothing to destroy*/
+	if(!wb)
+		return;
+	assert(!wb->len && !wb->dirty);
+		
+	/*Since the file is not open any more, an error of the last write in the
+		background can only be logged*/
+	if(wb->err)
+		LOG_MSG("writeback_destroy: Failed to write '%s' (%d).",
+			node->nn->lnode->name, wb->err);
+	
+	/*Free the state*/
+	free(wb->buf);
+	free(wb);
+	node->nn->wb = NULL;
+	}/*writeback_destroy*/
+/*----------------------------------------------------------------------------*/
@@ -0,0 +1,139 @@
+/*----------------------------------------------------------------------------*/
+/*writeback.h*/
+/*----------------------------------------------------------------------------*/
+/*Forwarding of writes to the underlying filesystem*/
+/*----------------------------------------------------------------------------*/
+/*Based on the code of unionfs translator.*/
+/*----------------------------------------------------------------------------*/
+/*Copyright (C) 2001, 2002, 2005 Free Software Foundation, Inc.
+  Written by Sergiu Ivanov <unlimitedscolobb@gmail.com>.
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License as
+  published by the Free Software Foundation; either version 2 of the
+  License, or * (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.*/
+/*----------------------------------------------------------------------------*/
+#ifndef __WRITEBACK_H__
+#define __WRITEBACK_H__
+
+/*----------------------------------------------------------------------------*/
+#include <error.h>
+#include <hurd/netfs.h>
+/*----------------------------------------------------------------------------*/
+#include "node.h"
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Macros--------------------------------------------------------------*/
+/*The default size of the write-behind buffer of a file (0 means writes go
+	through immediately)*/
+#define WRITEBACK_SIZE 0
+/*----------------------------------------------------------------------------*/
+/*The default time in seconds buffered data may wait before being written*/
+#define WRITEBACK_TIMEOUT 2
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Types---------------------------------------------------------------*/
+/*The write-behind state of a file: a run of sequential writes not yet
+	forwarded to the underlying file*/
+struct writeback
+	{
+	/*the node this state belongs to*/
+	node_t * node;
+	
+	/*the buffered data, their offset in the file, their length and the size
+		of the buffer*/
+	char * buf;
+	loff_t offset;
+	size_t len, size;
+	
+	/*the time the oldest buffered data arrived*/
+	time_t timestamp;
+	
+	/*the error of the last write which happened in the background, to be
+		reported to the next writer*/
+	error_t err;
+	
+	/*the neighbours in the list of files with buffered data and a flag
+		telling whether the file is in the list*/
+	struct writeback * prev, * next;
+	int dirty;
+	};/*struct writeback*/
+/*----------------------------------------------------------------------------*/
+typedef struct writeback writeback_t;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Global Variables----------------------------------------------------*/
+/*The size of the write-behind buffers (may be overwritten by the user)*/
+extern size_t writeback_size;
+/*----------------------------------------------------------------------------*/
+/*The time buffered data may wait (may be overwritten by the user)*/
+extern int writeback_timeout;
+/*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*/
+/*--------Functions-----------------------------------------------------------*/
+/*Starts the thread writing out the data which have waited too long*/
+error_t
+writeback_init(void);
+/*----------------------------------------------------------------------------*/
+/*Writes `len` bytes from `data` at `offset` into `node` (which must be
+	locked), either directly or through the write-behind buffer*/
+error_t
+writeback_write
+	(
+	node_t * node,
+	loff_t offset,
+	size_t * len,
+	void * data
+	);
+/*----------------------------------------------------------------------------*/
+/*Writes out the buffered data of `node` (which must be locked); an error is
+	kept to be reported by writeback_sync or by the next write*/
+void
+writeback_flush
+	(
+	node_t * node
+	);
+/*----------------------------------------------------------------------------*/
+/*Writes out the buffered data of `node` (which must be locked) and reports
+	the error of this or of any earlier write in the background*/
+error_t
+writeback_sync
+	(
+	node_t * node
+	);
+/*----------------------------------------------------------------------------*/
+/*Writes out the buffered data of all files*/
+void
+writeback_flush_all(void);
+/*----------------------------------------------------------------------------*/
+/*Drops whatever has been cached about the contents and the attributes of
+	`node` (which must be locked), after it has been modified*/
+void
+writeback_invalidate
+	(
+	node_t * node
+	);
+/*----------------------------------------------------------------------------*/
+/*Destroys the write-behind state of `node`; nothing is buffered any more,
+	because the list of files with buffered data keeps the node alive*/
+void
+writeback_destroy
+	(
+	node_t * node
+	);
+/*----------------------------------------------------------------------------*/
+#endif /*__WRITEBACK_H__*/